@@ -0,0 +1,78 @@
+// STL counterpart of containers.lpp, both run the same workloads
+#include <cstdio>
+#include <ctime>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+static void report(const char* name, clock_t start, long long checksum)
+{
+	printf("%-28s %8ld us  (checksum %lld)\n", name, long((clock() - start) * 1000000.0 / CLOCKS_PER_SEC), checksum);
+}
+
+static void benchVector(int n)
+{
+	clock_t start = clock();
+	std::vector<int> v;
+
+	for(int i = 0; i < n; i++)
+		v.push_back(i);
+
+	long long sum = 0;
+	for(size_t i = 0; i < v.size(); i++)
+		sum += v[i];
+
+	report("std::vector<int> push/get", start, sum);
+}
+
+static void benchMap(int n)
+{
+	clock_t start = clock();
+	std::unordered_map<int, int> m;
+
+	for(int i = 0; i < n; i++)
+		m[i * 7] = i;
+
+	long long sum = 0;
+	for(int i = 0; i < n; i++)
+	{
+		auto iter = m.find(i * 7);
+		sum += (iter != m.end() ? iter->second : 0);
+	}
+
+	for(int i = 0; i < n; i += 2)
+		m.erase(i * 7);
+
+	sum += m.size();
+	report("std::unordered_map put/get/remove", start, sum);
+}
+
+static void benchString(int n)
+{
+	clock_t start = clock();
+	int total = 0;
+
+	for(int i = 0; i < n; i++)
+	{
+		std::string s;
+		s.append("short");
+		s.push_back('!');
+		total += s.size();
+	}
+
+	std::string big;
+	for(int i = 0; i < n; i++)
+		big.append("0123456789");
+
+	total += big.size();
+	report("std::string append", start, total);
+}
+
+int main()
+{
+	const int n = 1000000;
+	benchVector(n);
+	benchMap(n);
+	benchString(n);
+	return 0;
+}
@@ -0,0 +1,30 @@
+// epoll calls behind the Executor of async.lpp.
+// struct epoll_event is packed on x86-64 only, so its layout stays in C.
+
+#include <sys/epoll.h>
+
+#define LPP_EPOLL_BATCH 64
+
+int lpp_epoll_arm(int poller, int fd, int events, void* task)
+{
+	struct epoll_event event;
+	event.events = events | EPOLLONESHOT;
+	event.data.ptr = task;
+
+	// EPOLL_CTL_MOD rearms known descriptors, new ones need EPOLL_CTL_ADD
+	if(epoll_ctl(poller, EPOLL_CTL_MOD, fd, &event) == 0)
+		return 0;
+	return epoll_ctl(poller, EPOLL_CTL_ADD, fd, &event);
+}
+
+int lpp_epoll_wait(int poller, void** tasks, int max, int timeout)
+{
+	struct epoll_event events[LPP_EPOLL_BATCH];
+	if(max > LPP_EPOLL_BATCH)
+		max = LPP_EPOLL_BATCH;
+
+	int count = epoll_wait(poller, events, max, timeout);
+	for(int i = 0; i < count; i++)
+		tasks[i] = events[i].data.ptr;
+	return count;
+}
@@ -0,0 +1,17 @@
+// Futex calls behind the channels of threads.lpp.
+// SYS_futex has a different number on every architecture.
+
+#include <linux/futex.h>
+#include <stddef.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+void lpp_futex_wait(int* address, int expected)
+{
+	syscall(SYS_futex, address, FUTEX_WAIT_PRIVATE, expected, NULL);
+}
+
+void lpp_futex_wake(int* address, int count)
+{
+	syscall(SYS_futex, address, FUTEX_WAKE_PRIVATE, count);
+}
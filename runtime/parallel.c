@@ -0,0 +1,203 @@
+// Work stealing scheduler behind 'parallel for'.
+// Every thread owns a range of the iteration space and takes chunks of grain
+// iterations from its front. Threads running out of work steal the upper half
+// of the range of another thread.
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+typedef void (*lpp_body)(void* ctx, int begin, int end);
+
+struct lpp_range
+{
+	pthread_mutex_t lock;
+	int begin;
+	int end;
+	char padding[64]; // Keep ranges of different threads on different cache lines
+};
+
+struct lpp_job
+{
+	lpp_body body;
+	void* ctx;
+	int grain;
+	atomic_int remaining;
+};
+
+static struct
+{
+	pthread_once_t once;
+	pthread_mutex_t lock; // Guards job and generation
+	pthread_cond_t wake;
+	pthread_mutex_t submit; // One parallel for at a time
+	struct lpp_job* job;
+	unsigned int generation;
+	atomic_int busy;
+	int threads; // Including the calling thread
+	struct lpp_range* ranges;
+} pool = { PTHREAD_ONCE_INIT, PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER, PTHREAD_MUTEX_INITIALIZER };
+
+static _Thread_local int worker = -1;
+
+static int take(struct lpp_range* range, int grain, int* begin, int* end)
+{
+	pthread_mutex_lock(&range->lock);
+	int found = range->begin < range->end;
+	if(found)
+	{
+		*begin = range->begin;
+		*end = (range->end - range->begin > grain ? range->begin + grain : range->end);
+		range->begin = *end;
+	}
+	pthread_mutex_unlock(&range->lock);
+	return found;
+}
+
+static int steal(int self, int grain)
+{
+	for(int i = 1; i < pool.threads; i++)
+	{
+		struct lpp_range* victim = &pool.ranges[(self + i) % pool.threads];
+		int begin = 0, end = 0;
+
+		pthread_mutex_lock(&victim->lock);
+		int count = victim->end - victim->begin;
+		if(count > 0)
+		{
+			begin = (count > grain ? victim->end - count / 2 : victim->begin);
+			end = victim->end;
+			victim->end = begin;
+		}
+		pthread_mutex_unlock(&victim->lock);
+
+		if(begin < end)
+		{
+			struct lpp_range* own = &pool.ranges[self];
+			pthread_mutex_lock(&own->lock);
+			own->begin = begin;
+			own->end = end;
+			pthread_mutex_unlock(&own->lock);
+			return 1;
+		}
+	}
+	return 0;
+}
+
+static void run(struct lpp_job* job, int self)
+{
+	int begin, end;
+	while(take(&pool.ranges[self], job->grain, &begin, &end) || (steal(self, job->grain) && take(&pool.ranges[self], job->grain, &begin, &end)))
+	{
+		job->body(job->ctx, begin, end);
+		atomic_fetch_sub_explicit(&job->remaining, end - begin, memory_order_release);
+	}
+}
+
+static void* work(void* arg)
+{
+	worker = (int) (size_t) arg;
+	unsigned int seen = 0;
+	for(;;)
+	{
+		pthread_mutex_lock(&pool.lock);
+		while(pool.generation == seen)
+			pthread_cond_wait(&pool.wake, &pool.lock);
+
+		seen = pool.generation;
+		struct lpp_job* job = pool.job;
+		if(job)
+			atomic_fetch_add(&pool.busy, 1);
+		pthread_mutex_unlock(&pool.lock);
+
+		if(job)
+		{
+			run(job, worker);
+			atomic_fetch_sub_explicit(&pool.busy, 1, memory_order_release);
+		}
+	}
+	return NULL;
+}
+
+static void start(void)
+{
+	const char* threads = getenv("LPP_THREADS");
+	pool.threads = (threads ? atoi(threads) : (int) sysconf(_SC_NPROCESSORS_ONLN));
+	if(pool.threads < 1)
+		pool.threads = 1;
+
+	pool.ranges = calloc(pool.threads, sizeof(struct lpp_range));
+	for(int i = 0; i < pool.threads; i++)
+		pthread_mutex_init(&pool.ranges[i].lock, NULL);
+
+	for(int i = 1; i < pool.threads; i++)
+	{
+		pthread_t thread;
+		if(pthread_create(&thread, NULL, work, (void*) (size_t) i) != 0)
+		{
+			pool.threads = i;
+			break;
+		}
+		pthread_detach(thread);
+	}
+}
+
+int lpp_parallel_threads(void)
+{
+	pthread_once(&pool.once, start);
+	return pool.threads;
+}
+
+void lpp_parallel_for(void* body, void* ctx, int first, int last, int grain)
+{
+	if(first >= last)
+		return;
+
+	int count = last - first;
+	int threads = lpp_parallel_threads();
+
+	// Nested loops run on the thread that reaches them
+	if(worker >= 0 || threads == 1 || count <= grain)
+	{
+		((lpp_body) body)(ctx, first, last);
+		return;
+	}
+
+	// Enough chunks for load balancing without paying for tiny ones
+	if(grain <= 0)
+		grain = (count / (threads * 8) > 0 ? count / (threads * 8) : 1);
+
+	pthread_mutex_lock(&pool.submit);
+	worker = 0;
+
+	struct lpp_job job = { (lpp_body) body, ctx, grain };
+	atomic_init(&job.remaining, count);
+
+	for(int i = 0; i < threads; i++)
+	{
+		pool.ranges[i].begin = first + (int) ((long long) count * i / threads);
+		pool.ranges[i].end = first + (int) ((long long) count * (i + 1) / threads);
+	}
+
+	pthread_mutex_lock(&pool.lock);
+	pool.job = &job;
+	pool.generation++;
+	pthread_cond_broadcast(&pool.wake);
+	pthread_mutex_unlock(&pool.lock);
+
+	run(&job, 0);
+	while(atomic_load_explicit(&job.remaining, memory_order_acquire) > 0)
+		sched_yield();
+
+	// Late workers must not see the job once it leaves this stack frame
+	pthread_mutex_lock(&pool.lock);
+	pool.job = NULL;
+	pthread_mutex_unlock(&pool.lock);
+	while(atomic_load_explicit(&pool.busy, memory_order_acquire) > 0)
+		sched_yield();
+
+	worker = -1;
+	pthread_mutex_unlock(&pool.submit);
+}
@@ -0,0 +1,60 @@
+// C side of the by-value calls tested in main.lpp, clang lowers these
+// structures the way every C library on the target expects them.
+
+#include <stdint.h>
+
+struct Rect
+{
+	float x, y, w, h;
+};
+
+struct Tagged
+{
+	int tag;
+	float weight;
+	int64_t id;
+};
+
+// Defined in main.lpp
+struct Rect lppGrow(struct Rect rect, float by);
+float lppFifthWidth(struct Rect a, struct Rect b, struct Rect c, struct Rect d, struct Rect e);
+
+struct Rect cabi_translate(struct Rect rect, float dx, float dy)
+{
+	rect.x += dx;
+	rect.y += dy;
+	return rect;
+}
+
+struct Tagged cabi_retag(struct Tagged value, int tag)
+{
+	value.tag = tag;
+	value.weight += 0.5f;
+	value.id *= 2;
+	return value;
+}
+
+float cabi_grown_area(struct Rect rect)
+{
+	struct Rect grown = lppGrow(rect, 1.0f);
+	return grown.w * grown.h;
+}
+
+// Four Rect take all 8 SSE registers, the fifth one is passed in memory
+float cabi_fifth_width(struct Rect a, struct Rect b, struct Rect c, struct Rect d, struct Rect e)
+{
+	return a.x + e.w;
+}
+
+// Three Tagged take all 6 integer registers, the fourth one is passed in memory
+int64_t cabi_fourth_id(struct Tagged a, struct Tagged b, struct Tagged c, struct Tagged d)
+{
+	return a.id + d.id;
+}
+
+float cabi_call_fifth_width(struct Rect rect)
+{
+	struct Rect wide = rect;
+	wide.w = 100.0f;
+	return lppFifthWidth(rect, rect, rect, rect, wide);
+}
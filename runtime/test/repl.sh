@@ -0,0 +1,13 @@
+#!/bin/sh
+# Feeds repl.lpp to 'l++ --repl' and checks the values it printed.
+# Every input is compiled on its own, so the later ones call functions of earlier ones.
+# Usage: repl.sh <l++>
+
+output=$("$1" --repl < "$(dirname "$0")/repl.lpp" | sed 's/^\(> \|\.\.\. \)*//')
+for expected in 49 27; do
+	if ! echo "$output" | grep -qx "$expected"; then
+		echo "The REPL did not print $expected:"
+		echo "$output"
+		exit 1
+	fi
+done
@@ -6,15 +6,35 @@
 #include <iostream>
 #include <fstream>
 #include <stack>
+#include <map>
 #include <unordered_map>
+#include <unordered_set>
 #include <sstream>
+#include <cerrno>
+#include <climits>
+#include <cstdlib>
 
 #include "Util.h"
 #include "MetaContext.h"
+#include "Interpreter.h"
+#include "Simplifier.h"
+#include "Generics.h"
 
 #include <llvm/IR/LLVMContext.h>
 #include <llvm/IR/Module.h>
 #include <llvm/IR/IRBuilder.h>
+#include <llvm/IR/Intrinsics.h>
+#include <llvm/IR/MDBuilder.h>
+#include <llvm/Analysis/ValueTracking.h>
+#include <llvm/ADT/Triple.h>
+#include <llvm/Support/Host.h>
+#include <llvm/Support/TargetSelect.h>
+#include <llvm/Target/TargetMachine.h>
+#if LLVM_VERSION_MAJOR >= 14
+#include <llvm/MC/TargetRegistry.h>
+#else
+#include <llvm/Support/TargetRegistry.h>
+#endif
 
 #include <llvm/Bitcode/BitcodeWriter.h>
 //#include <llvm/Bitcode/ReaderWriter.h>
@@ -27,6 +47,7 @@
 #include <llvm/IR/LegacyPassNameParser.h>
 #include <llvm/Transforms/IPO/PassManagerBuilder.h>
 #include <llvm/Transforms/IPO.h>
+#include <llvm/Transforms/Utils/Cloning.h>
 
 #include <sys/stat.h>
 #include <unistd.h>
@@ -42,6 +63,20 @@ struct CompilationFlags
 	std::string output;
 	std::string input;
 	std::string includePath;
+	bool fastMath = false; // Default of functions without fast-math attributes
+
+	std::string targetCpu = "native"; // The CPU running the compiler
+	std::string targetFeatures; // Like "+avx2,-avx512f", added to the ones of the CPU
+
+	bool run = false; // Execute main in a JIT instead of writing files
+	std::vector<std::string> runArguments; // Everything after --run
+	bool repl = false;
+
+	// Limits of every meta block, 0 is unlimited
+	uint64_t metaInstructions = 0;
+	unsigned int metaMilliseconds = 0;
+	size_t metaMemory = 0; // Bytes a block may add to the Lua heap
+	bool metaProfile = false; // Report time and allocations of the meta blocks
 };
 
 class SourceLocation
@@ -67,6 +102,7 @@ public:
 class Expr
 {
 	SourceLocation Location;
+	std::vector<std::string> Attributes;
 public:
 	virtual ~Expr() {}
 	virtual void dump()
@@ -84,6 +120,28 @@ public:
 	
 	SourceLocation getLocation() { return Location; }
 	void setLocation(const SourceLocation& loc) { Location = loc; }
+
+	std::vector<std::string>& getAttributes() { return Attributes; }
+	bool hasAttribute(const std::string& name) const
+	{
+		for(auto& a : Attributes)
+			if(a == name)
+				return true;
+		return false;
+	}
+
+	std::string getAttributeString() const
+	{
+		if(Attributes.empty())
+			return "";
+
+		std::stringstream ss;
+		ss << "[[";
+		for(size_t i = 0; i < Attributes.size(); i++)
+			ss << Attributes[i] << (i != Attributes.size() - 1 ? ", " : "");
+		ss << "]] ";
+		return ss.str();
+	}
 };
 
 class TypeCast : public Expr
@@ -96,6 +154,7 @@ public:
 		
 	std::string getType() const override { return Type; }
 	std::shared_ptr<Expr> getValue() { return Value; }
+	void setValue(const std::shared_ptr<Expr>& value) { Value = value; }
 };
 
 class Number : public Expr
@@ -295,6 +354,62 @@ public:
 	std::shared_ptr<Expr>& getInc() { return Inc; }
 };
 
+// 'parallel for i = first, last[, grain] [reduce op name, ...] do ... end'
+// Runs chunks of iterations on the scheduler of the parallel module. Everything
+// else sees a plain for loop, the interpreter runs it sequentially.
+class ParallelFor : public For
+{
+	std::shared_ptr<Expr> Grain; // Iterations per chunk, picked at runtime if null
+	std::vector<std::pair<std::string, std::string>> Reductions; // Operator and variable
+public:
+	ParallelFor(std::shared_ptr<Expr> init, std::shared_ptr<Expr> cond, std::shared_ptr<Expr> inc, std::shared_ptr<Expr> grain)
+		: For(init, cond, inc), Grain(grain) {}
+
+	std::string toLua() const override
+	{
+		return "-- parallel\n" + For::toLua();
+	}
+
+	std::shared_ptr<Expr>& getGrain() { return Grain; }
+	std::vector<std::pair<std::string, std::string>>& getReductions() { return Reductions; }
+};
+
+// 'for value in range do ... end' and 'for i, value in range do ... end' over slices and fixed arrays.
+// value is a copy of the element, i its index.
+class RangeFor : public Expr
+{
+	std::string Index;
+	std::string Value;
+	std::shared_ptr<Expr> Range;
+	std::vector<std::shared_ptr<Expr>> Body;
+public:
+	RangeFor(const std::string& index, const std::string& value, std::shared_ptr<Expr> range)
+		: Index(index), Value(value), Range(range) {}
+
+	std::string toLua() const override
+	{
+		std::stringstream ss;
+		ss << "for " << (Index.empty() ? "_" : Index) << ", " << Value << " in ipairs(" << Range->toLua() << ") do\n";
+		for(auto& k : Body)
+			ss << k->toLua() << "\n";
+		ss << "end\n";
+		return ss.str();
+	}
+
+	void dump() override
+	{
+		std::cout << "RangeFor " << Index << " " << Value << "\n";
+		Range->dump();
+		for(auto& k : Body)
+			k->dump();
+	}
+
+	const std::string& getIndex() const { return Index; }
+	const std::string& getValue() const { return Value; }
+	std::shared_ptr<Expr>& getRange() { return Range; }
+	std::vector<std::shared_ptr<Expr>>& getBody() { return Body; }
+};
+
 class VariableDef : public Expr
 {
 	std::string Name;
@@ -302,12 +417,23 @@ class VariableDef : public Expr
 	std::shared_ptr<Expr> Initial;
 	unsigned int Size; // Array size
     bool Extern;
+	bool Const; // Initial value is computed at compile time
+	bool Atomic = false; // Loads and stores are sequentially consistent
+	bool ThreadLocal = false; // Every thread has its own copy
 public:
 	VariableDef(const std::string& name, const std::string& type, std::shared_ptr<Expr> initial, unsigned int size = 0) 
-		: Name(name), Type(type), Initial(initial), Size(size), Extern(false) {}
+		: Name(name), Type(type), Initial(initial), Size(size), Extern(false), Const(false) {}
 
 	void setExtern(bool b) { Extern = b; }
 	bool getExtern() const { return Extern; }
+	void setConst(bool b) { Const = b; }
+	bool getConst() const { return Const; }
+	void setAtomic(bool b) { Atomic = b; }
+	bool getAtomic() const { return Atomic; }
+	void setThreadLocal(bool b) { ThreadLocal = b; }
+	bool getThreadLocal() const { return ThreadLocal; }
+	void setType(const std::string& type) { Type = type; }
+	void setInitial(const std::shared_ptr<Expr>& initial) { Initial = initial; }
 	std::string getName() const { return Name; }
 	std::string getType() const override { return Type; }
 	unsigned int getSize() const { return Size; }
@@ -327,7 +453,7 @@ public:
 
 	std::string getDefinitionString() override
 	{
-		return "extern local " + Name + " -> " + Type + (Size > 0 ? "[" + std::to_string(Size) + "]" : "") + "\n";
+		return std::string(ThreadLocal ? "thread " : "") + "extern local " + Name + " -> " + (Atomic ? "atomic " : "") + Type + (Size > 0 ? "[" + std::to_string(Size) + "]" : "") + "\n";
 	}
 };
 
@@ -341,6 +467,10 @@ class Function : public Expr
 	
 	bool Variadic;
 	bool IsMember;
+
+	std::vector<std::string> TypeParams;
+	bool TemplateInstance = false;
+	bool Async = false; // Calls return a coroutine handle, the return type is the type of the result
 public:
 	Function(const std::string& name, const std::string& ret, bool ext = false) 
 		: Name(name), ReturnType(ret), Extern(ext), Variadic(false), IsMember(false) {}
@@ -388,9 +518,22 @@ public:
 	bool getExtern() const { return Extern; }
 	bool isMember() const { return IsMember; }
 	void setMember(bool value) { IsMember = value; }
+
+	std::vector<std::string>& getTypeParams() { return TypeParams; }
+	bool isTemplate() const { return !TypeParams.empty(); }
+	bool isTemplateInstance() const { return TemplateInstance; }
+	void setTemplateInstance(bool value) { TemplateInstance = value; }
+	bool isAsync() const { return Async; }
+	void setAsync(bool value) { Async = value; }
 	
 	const std::string getName() const { return Name; }
 	const std::string getReturnType() const { return ReturnType; }
+
+	// Several results are stored as "(int,bool)" but written as '-> int, bool'
+	std::string getResultTypes() const
+	{
+		return (!ReturnType.empty() && ReturnType[0] == '(' ? ReturnType.substr(1, ReturnType.size() - 2) : ReturnType);
+	}
 	std::vector<std::shared_ptr<Expr>>& getBody() { return Body; }
 	std::vector<std::shared_ptr<Expr>>& getArgs() { return Args; }
 
@@ -401,7 +544,7 @@ public:
 		//	return "";
 		
 		std::stringstream ss;
-		ss << "extern function " << Name << "(";
+		ss << getAttributeString() << (Async ? "async " : "") << "extern function " << Name << "(";
 
 		// First argument is always self when in a class
 		size_t i = (IsMember ? 1 : 0);
@@ -415,7 +558,7 @@ public:
 		if(Variadic)
 			ss << ", ...";
 
-		ss << ") -> " << ReturnType << "\n";
+		ss << ") -> " << getResultTypes() << "\n";
 		return ss.str();
 	}
 
@@ -527,10 +670,12 @@ public:
 class Return : public Expr
 {
 	std::shared_ptr<Expr> Value;
+	bool Tail = false; // 'return tail f()' has to reuse the stack frame
 public:
-	Return(const std::shared_ptr<Expr>& value) : Value(value) {}
+	Return(const std::shared_ptr<Expr>& value, bool tail = false) : Value(value), Tail(tail) {}
 	std::shared_ptr<Expr>& getValue() { return Value; }
-	void dump() override { std::cout << "Return" << std::endl; if(Value) Value->dump(); }
+	bool isTail() const { return Tail; }
+	void dump() override { std::cout << (Tail ? "Tail Return" : "Return") << std::endl; if(Value) Value->dump(); }
 
 	std::string toLua() const override
 	{
@@ -540,6 +685,90 @@ public:
 	std::string getType() const override { return Value == nullptr ? "void" : Value->getType(); }
 };
 
+// Suspends an async function, the value is the next result seen by its caller
+class Yield : public Expr
+{
+	std::shared_ptr<Expr> Value;
+public:
+	Yield(const std::shared_ptr<Expr>& value) : Value(value) {}
+	std::shared_ptr<Expr>& getValue() { return Value; }
+	void dump() override { std::cout << "Yield" << std::endl; if(Value) Value->dump(); }
+
+	std::string toLua() const override
+	{
+		return "coroutine.yield(" + (Value != nullptr ? Value->toLua() : "") + ")\n";
+	}
+};
+
+// Runs the coroutine returned by a call of an async function to its end,
+// suspending the calling coroutine whenever the awaited one suspends
+class Await : public Expr
+{
+	std::shared_ptr<Expr> Value;
+public:
+	Await(const std::shared_ptr<Expr>& value) : Value(value) {}
+	std::shared_ptr<Expr>& getValue() { return Value; }
+	void dump() override { std::cout << "Await" << std::endl; Value->dump(); }
+	std::string toLua() const override { return Value->toLua(); }
+};
+
+// 'return a, b' and the right side of 'a, b = b, a', becomes an anonymous struct
+class ValueList : public Expr
+{
+	std::vector<std::shared_ptr<Expr>> Values;
+public:
+	ValueList() {}
+	std::vector<std::shared_ptr<Expr>>& getValues() { return Values; }
+
+	void dump() override
+	{
+		std::cout << "ValueList: " << Values.size() << " values" << std::endl;
+		for(auto& k : Values)
+			k->dump();
+	}
+
+	std::string toLua() const override
+	{
+		std::stringstream ss;
+		for(auto& k : Values)
+			ss << k->toLua() << (k != Values.back() ? ", " : "");
+		return ss.str();
+	}
+};
+
+// 'local q, r = divmod(a, b)' and 'q, r = divmod(a, b)': every target gets one result,
+// all values are evaluated before the first one is assigned
+class Unpack : public Expr
+{
+	std::vector<std::shared_ptr<Expr>> Targets;
+	std::vector<std::shared_ptr<Expr>> Values;
+	bool Declaration;
+public:
+	Unpack(bool declaration) : Declaration(declaration) {}
+	std::vector<std::shared_ptr<Expr>>& getTargets() { return Targets; }
+	std::vector<std::shared_ptr<Expr>>& getValues() { return Values; }
+	bool isDeclaration() const { return Declaration; }
+
+	void dump() override
+	{
+		std::cout << "Unpack: " << Targets.size() << " targets" << std::endl;
+		for(auto& k : Values)
+			k->dump();
+	}
+
+	std::string toLua() const override
+	{
+		std::stringstream ss;
+		ss << (Declaration ? "local " : "");
+		for(auto& k : Targets)
+			ss << k->toLua() << (k != Targets.back() ? ", " : "");
+		ss << " = ";
+		for(auto& k : Values)
+			ss << k->toLua() << (k != Values.back() ? ", " : "");
+		return ss.str() + "\n";
+	}
+};
+
 class Variable : public Expr
 {
 	std::string Name;
@@ -556,6 +785,7 @@ public:
 	void setField(std::shared_ptr<Variable> field) { Field = field; }
 	void setIndex(std::shared_ptr<Expr> idx) { Index = idx; }
 	void setFunctionCall(std::shared_ptr<AST::FunctionCall> call) { FunctionCall = call; }
+	std::shared_ptr<AST::FunctionCall> getFunctionCall() const { return FunctionCall; }
 
 	void dump() override 
 	{ 
@@ -584,6 +814,33 @@ public:
 	}
 };
 
+class ArrayLiteral : public Expr
+{
+	std::vector<std::shared_ptr<Expr>> Values;
+public:
+	ArrayLiteral() {}
+	std::vector<std::shared_ptr<Expr>>& getValues() { return Values; }
+
+	void dump() override
+	{
+		std::cout << "ArrayLiteral: " << Values.size() << " values" << std::endl;
+		for(auto& k : Values)
+			k->dump();
+	}
+
+	std::string toLua() const override
+	{
+		std::stringstream ss;
+		ss << "{";
+		for(auto& k : Values)
+			ss << k->toLua() << (k != Values.back() ? ", " : "");
+		ss << "}";
+		return ss.str();
+	}
+
+	std::string getType() const override { return Values.empty() ? "void" : Values[0]->getType(); }
+};
+
 class Label : public Expr
 {
 	std::string Name;
@@ -619,10 +876,18 @@ class ClassDef : public Expr
 	
 	std::vector<std::shared_ptr<VariableDef>> Fields;
 	std::vector<std::shared_ptr<Function>> Methods;
+
+	std::vector<std::string> TypeParams;
+	bool TemplateInstance = false;
 public:
 	ClassDef(const std::string& name) : Name(name) {}
 	std::string getName() const { return Name; }
 	std::vector<std::shared_ptr<Expr>>& getBody() { return Body; }
+
+	std::vector<std::string>& getTypeParams() { return TypeParams; }
+	bool isTemplate() const { return !TypeParams.empty(); }
+	bool isTemplateInstance() const { return TemplateInstance; }
+	void setTemplateInstance(bool value) { TemplateInstance = value; }
 	
 	std::vector<std::shared_ptr<VariableDef>>& getFields() { return Fields; }
 	std::vector<std::shared_ptr<Function>>& getMethods() { return Methods; }
@@ -758,11 +1023,58 @@ class Module
 		return (llvm::isa<llvm::AllocaInst>(v) || v->getType()->isPointerTy() ? builder.CreateLoad(v) : v);
 	}
 
-	llvm::LLVMContext context;
+	// The JIT takes the context over together with the module
+	std::unique_ptr<llvm::LLVMContext> OwnedContext = std::make_unique<llvm::LLVMContext>();
+	llvm::LLVMContext& context = *OwnedContext;
 	std::string SourceName;
 	std::string SourcePath;
 	unsigned int ErrorCount = 0;
 	CompilationFlags Flags;
+	Monomorphizer Generics{*this};
+	std::unordered_set<llvm::Value*> AtomicValues; // Storage of atomic variables
+
+	// State of the async function currently generated
+	struct Coroutine
+	{
+		llvm::Value* Id = nullptr;
+		llvm::Value* Handle = nullptr;
+		llvm::AllocaInst* Promise = nullptr; // Holds the latest result, null for void
+		llvm::BasicBlock* Final = nullptr;
+		llvm::BasicBlock* Cleanup = nullptr;
+		llvm::BasicBlock* Suspend = nullptr;
+	};
+
+	Coroutine* CurrentCoroutine = nullptr;
+	std::unordered_map<std::string, std::string> AsyncFunctions; // Result type of every async function
+	bool UsesCoroutines = false; // Some llvm.coro intrinsic was emitted and needs the coroutine passes
+
+	// How a value of a class type crosses a call
+	struct PassingConvention
+	{
+		enum Kind { Direct, Coerced, Memory };
+		Kind How;
+		llvm::Type* Type; // What the signature uses in place of the value
+	};
+
+	std::unordered_map<llvm::Function*, llvm::FunctionType*> SourceTypes; // Signatures changed by the C ABI
+
+	// Alias scope and noalias list for the accesses through every restrict slice parameter
+	std::unordered_map<llvm::Value*, std::pair<llvm::MDNode*, llvm::MDNode*>> RestrictScopes;
+
+	// TBAA type nodes, every pointer shares the node of @byte
+	llvm::MDNode* TbaaRoot = nullptr;
+	std::unordered_map<llvm::Type*, llvm::MDNode*> TbaaTypes;
+
+	std::string TargetCpu;
+	std::string TargetFeatures;
+	std::vector<std::pair<Function*, llvm::Function*>> Multiversioned; // Dispatched once the module is complete
+
+	// Every REPL input becomes a module of its own. ReplDeclarations declares
+	// what earlier inputs defined, so later ones find it in their llvm::Module.
+	LocalScope ReplScope;
+	std::unique_ptr<llvm::Module> ReplDeclarations;
+	std::unordered_set<std::string> ReplDefined;
+	size_t Generated = 0; // TopLevel entries compiled by earlier inputs
 
 	std::function<std::shared_ptr<Module>(const std::string&)> IncludeCallback = [](const std::string&) { return nullptr; };
 public:
@@ -775,9 +1087,15 @@ public:
 	
 	void setIncludeCallback(const std::function<std::shared_ptr<Module>(const std::string&)>& func) { IncludeCallback = func; }
 	void setSourceName(const std::string& name) { SourceName = name; }
+	const std::string& getSourceName() const { return SourceName; }
 	void setSourcePath(const std::string& name) { SourcePath = name; }
 	void setFlags(const CompilationFlags& flags) { Flags = flags; }
 	CompilationFlags getFlags() { return Flags; }
+	bool usesCoroutines() const { return UsesCoroutines; }
+	const std::string& getTargetCpu() const { return Flags.targetCpu; }
+	const std::vector<std::string>& getRequiredModules() const { return RequiredLibraries; }
+	unsigned int getErrorCount() const { return ErrorCount; }
+	std::unique_ptr<llvm::LLVMContext> takeContext() { return std::move(OwnedContext); }
 	
 	std::string getRequiredLibraries()
 	{
@@ -791,6 +1109,8 @@ public:
 	{
 		TopLevel.push_back(expr);
 	}
+
+	std::vector<std::shared_ptr<Expr>>& getTopLevel() { return TopLevel; }
 	
 	llvm::Value* generateIr(std::shared_ptr<Expr> k, LocalScope& scope, llvm::IRBuilder<>& builder, llvm::Module* module)
 	{
@@ -800,11 +1120,29 @@ public:
 		Function* function = dynamic_cast<Function*>(k.get());
 		if(function)
 		{	
+			// Templates are only generated through their instances
+			if(function->isTemplate())
+			{
+				scope.exit();
+				return nullptr;
+			}
+
 			std::vector<llvm::Type*> args;
+			std::vector<bool> restricted;
 			
 			for(auto& p : function->getArgs())
 			{
-				llvm::Type* type = getType(builder, dynamic_cast<VariableDef*>(p.get())->getType(), module);
+				std::string argType = dynamic_cast<VariableDef*>(p.get())->getType();
+				restricted.push_back(argType.compare(0, 9, "restrict ") == 0);
+				if(restricted.back())
+					argType = argType.substr(9);
+
+				llvm::Type* type = getType(builder, argType, module);
+				if(type && restricted.back() && !type->isPointerTy() && !isSlice(type))
+				{
+					error("only pointers and slices can be restrict", p->getLocation());
+					return nullptr;
+				}
 
 				if(!type)
 				{
@@ -823,8 +1161,53 @@ public:
 				return nullptr;
 			}
 
-			llvm::FunctionType* funcType = llvm::FunctionType::get(type, argsRef, function->getVariadic());
-			llvm::Function* llvmFunction = llvm::Function::Create(funcType, llvm::Function::ExternalLinkage, function->getName(), module);
+			// Calls of async functions return the handle of the new coroutine
+			llvm::Type* resultType = type;
+			if(function->isAsync())
+			{
+				AsyncFunctions[function->getName()] = function->getReturnType();
+				type = builder.getInt8PtrTy();
+			}
+
+			// Class values cross calls the way the C ABI of the target passes them
+			llvm::FunctionType* sourceType = llvm::FunctionType::get(type, argsRef, function->getVariadic());
+			PassingConvention result = classify(type, module);
+			std::vector<llvm::Type*> lowered;
+			if(result.How == PassingConvention::Memory)
+				lowered.push_back(result.Type);
+
+			std::vector<unsigned int> firstParam; // Lowered index of every argument
+			for(auto& passing : classifyParams(type, args, module))
+			{
+				firstParam.push_back(lowered.size());
+				auto params = getLoweredParams(passing);
+				lowered.insert(lowered.end(), params.begin(), params.end());
+			}
+
+			llvm::Type* loweredResult = (result.How == PassingConvention::Memory ? builder.getVoidTy() : result.Type);
+			llvm::FunctionType* funcType = llvm::FunctionType::get(loweredResult, lowered, function->getVariadic());
+			// Every module using an instance carries its own copy, the linker keeps one
+			auto linkage = (function->isTemplateInstance() ? llvm::Function::LinkOnceODRLinkage : llvm::Function::ExternalLinkage);
+			// A definition completes an earlier extern declaration, which makes mutual recursion possible
+			llvm::Function* llvmFunction = module->getFunction(function->getName());
+			if(llvmFunction && llvmFunction->isDeclaration() && !function->getExtern() && llvmFunction->getFunctionType() == funcType)
+				llvmFunction->setLinkage(linkage);
+			else
+				llvmFunction = llvm::Function::Create(funcType, linkage, function->getName(), module);
+			applyFunctionAttributes(function, llvmFunction);
+			if(!function->getExtern())
+				applyTargetAttributes(llvmFunction);
+
+			if(funcType != sourceType)
+			{
+				SourceTypes[llvmFunction] = sourceType;
+				applyPassingAttributes(llvmFunction, sourceType, module);
+			}
+
+			// Restrict pointers are the only way to reach their memory while the function runs
+			for(unsigned int i = 0; i < args.size(); i++)
+				if(restricted[i] && args[i]->isPointerTy())
+					llvmFunction->addParamAttr(firstParam[i], llvm::Attribute::NoAlias);
 			
 			if(!function->getExtern())
 			{
@@ -832,22 +1215,76 @@ public:
 				builder.SetInsertPoint(entry);
 				
 				{
-					unsigned int i = 0;
-					for(auto& param : llvmFunction->args())
+					if(result.How == PassingConvention::Memory)
+						llvmFunction->getArg(0)->setName("result");
+
+					for(unsigned int i = 0; i < args.size(); i++)
 					{
-						const std::string& name = dynamic_cast<VariableDef*>(function->getArgs()[i++].get())->getName();
-						param.setName(name);
-						
-						currentScope[name] = builder.CreateAlloca(param.getType(), 0, (name + "_local"));
-						builder.CreateStore(&param, currentScope[name]);
+						llvm::Type* type = args[i];
+						const std::string& name = dynamic_cast<VariableDef*>(function->getArgs()[i].get())->getName();
+						llvm::Argument* param = llvmFunction->getArg(firstParam[i]);
+						unsigned int parts = (i + 1 < args.size() ? firstParam[i + 1] : lowered.size()) - firstParam[i];
+
+						// The caller passes a private copy, coroutines still need their own one in the frame
+						if(param->hasByValAttr() && !function->isAsync())
+						{
+							param->setName(name);
+							currentScope[name] = param;
+							continue;
+						}
+
+						// Eightbytes passed separately are put back together first
+						llvm::Value* value = param;
+						if(parts > 1)
+						{
+							auto coerced = llvm::StructType::get(context, llvm::ArrayRef<llvm::Type*>(lowered).slice(firstParam[i], parts));
+							value = llvm::UndefValue::get(coerced);
+							for(unsigned int j = 0; j < parts; j++)
+							{
+								llvmFunction->getArg(firstParam[i] + j)->setName(name + "." + std::to_string(j));
+								value = builder.CreateInsertValue(value, llvmFunction->getArg(firstParam[i] + j), j);
+							}
+						}
+						else
+							param->setName(name);
+
+						currentScope[name] = builder.CreateAlloca(type, 0, (name + "_local"));
+						builder.CreateStore((value->getType() == type ? value : raiseValue(value, type, builder, module)), currentScope[name]);
 					}
+
+					std::vector<llvm::Value*> restrictSlices;
+					for(unsigned int i = 0; i < args.size(); i++)
+						if(restricted[i] && isSlice(args[i]))
+							restrictSlices.push_back(currentScope[dynamic_cast<VariableDef*>(function->getArgs()[i].get())->getName()]);
+
+					declareRestrictScopes(restrictSlices, builder, module);
 				}
 					
+				Coroutine coroutine;
+				Coroutine* outerCoroutine = CurrentCoroutine;
+				CurrentCoroutine = nullptr;
+				if(function->isAsync())
+				{
+					beginCoroutine(coroutine, resultType, builder, module);
+					CurrentCoroutine = &coroutine;
+				}
+
+				// Float operations of the body pick the flags up from the builder
+				llvm::IRBuilderBase::FastMathFlagGuard fastMathGuard(builder);
+				builder.setFastMathFlags(getFastMathFlags(function, llvmFunction));
+
 				generateIr(function->getBody(), scope, builder, module);
-				if(funcType->getReturnType()->isVoidTy())
+				if(function->isAsync())
+					endCoroutine(coroutine, builder, module);
+				else if(funcType->getReturnType()->isVoidTy())
 					builder.CreateRetVoid();
+
+				CurrentCoroutine = outerCoroutine;
 			}
 
+			if(isMultiversioned(function) && !function->getExtern())
+				Multiversioned.emplace_back(function, llvmFunction);
+
 			scope.exit();
 			return llvmFunction;
 		}
@@ -899,7 +1336,31 @@ public:
 						if (left->getType()->isFloatingPointTy())
 							retval = builder.CreateFDiv(left, right, "fdiv");
 						else
-							retval = builder.CreateExactSDiv(left, right, "div");
+							retval = builder.CreateSDiv(left, right, "div");
+						break;
+
+					case '%':
+						left = var2val(builder, left);
+						right = var2val(builder, right);
+						if (left->getType()->isFloatingPointTy())
+							retval = builder.CreateFRem(left, right, "frem");
+						else if (left->getType()->isIntegerTy())
+							retval = builder.CreateSRem(left, right, "rem");
+						break;
+
+					case '&':
+						if (left->getType()->isIntegerTy() && right->getType()->isIntegerTy())
+							retval = builder.CreateAnd(left, right, "and");
+						break;
+
+					case '|':
+						if (left->getType()->isIntegerTy() && right->getType()->isIntegerTy())
+							retval = builder.CreateOr(left, right, "or");
+						break;
+
+					case '^':
+						if (left->getType()->isIntegerTy() && right->getType()->isIntegerTy())
+							retval = builder.CreateXor(left, right, "xor");
 						break;
 
 					case '>':
@@ -921,12 +1382,14 @@ public:
 						break;
 
 					case '=':
+					{
 						/*if(llvm::isa<llvm::AllocaInst>(right))
 						{
 							right = var2val(builder, right);
 						}*/
 
-						left = static_cast<llvm::LoadInst*>(left)->getPointerOperand();
+						auto* load = static_cast<llvm::LoadInst*>(left);
+						left = load->getPointerOperand();
 						if (!left)
 						{
 							error("left assignment operand is not a variable", binop->getLocation());
@@ -951,19 +1414,44 @@ public:
 							llvm::report_fatal_error("Can only store into references!");
 						}
 
-						retval = builder.CreateStore(right, left);
+						auto* store = builder.CreateStore(right, left);
+						if (load->isAtomic())
+							store->setAtomic(load->getOrdering());
+						store->copyMetadata(*load, {llvm::LLVMContext::MD_tbaa, llvm::LLVMContext::MD_alias_scope, llvm::LLVMContext::MD_noalias});
+
+						// The load only served to find the address
+						eraseDeadLoad(load);
+						retval = store;
 						break;
+					}
 				}
 			}
 			else
 			{
-				if (binop->getOp() == "==")
+				// Classes are compared by user defined operators
+				if ((binop->getOp() == "==" || binop->getOp() == "~=") && left->getType()->isStructTy())
+					retval = nullptr;
+				else if ((binop->getOp() == "<<" || binop->getOp() == ">>")
+						 && left->getType()->isIntegerTy() && right->getType()->isIntegerTy())
 				{
-					if (left->getType()->isPointerTy())
-						left = builder.CreatePtrToInt(left, builder.getInt32Ty(), "left_ptr_to_int");
+					if (binop->getOp() == "<<")
+						retval = builder.CreateShl(left, right, "shl");
+					else
+						retval = builder.CreateLShr(left, right, "lshr");
+				}
+				else if (binop->getOp() == "==")
+				{
+					// Pointers are compared in full, only mixed comparisons go through int
+					if (left->getType()->isPointerTy() && right->getType()->isPointerTy())
+						right = builder.CreatePointerCast(right, left->getType(), "right_ptr_cast");
+					else
+					{
+						if (left->getType()->isPointerTy())
+							left = builder.CreatePtrToInt(left, builder.getInt32Ty(), "left_ptr_to_int");
 
-					if (right->getType()->isPointerTy())
-						right = builder.CreatePtrToInt(right, builder.getInt32Ty(), "right_ptr_to_int");
+						if (right->getType()->isPointerTy())
+							right = builder.CreatePtrToInt(right, builder.getInt32Ty(), "right_ptr_to_int");
+					}
 
 					if (left->getType() != right->getType())
 						error("comparison expected '"
@@ -996,11 +1484,17 @@ public:
 				}
 				else if (binop->getOp() == "~=")
 				{
-					if (left->getType()->isPointerTy())
-						left = builder.CreatePtrToInt(left, builder.getInt32Ty(), "left_ptr_to_int");
+					// Pointers are compared in full, only mixed comparisons go through int
+					if (left->getType()->isPointerTy() && right->getType()->isPointerTy())
+						right = builder.CreatePointerCast(right, left->getType(), "right_ptr_cast");
+					else
+					{
+						if (left->getType()->isPointerTy())
+							left = builder.CreatePtrToInt(left, builder.getInt32Ty(), "left_ptr_to_int");
 
-					if (right->getType()->isPointerTy())
-						right = builder.CreatePtrToInt(right, builder.getInt32Ty(), "right_ptr_to_int");
+						if (right->getType()->isPointerTy())
+							right = builder.CreatePtrToInt(right, builder.getInt32Ty(), "right_ptr_to_int");
+					}
 
 					if (left->getType()->isFloatingPointTy())
 						retval = builder.CreateFCmpONE(left, right, "fcmpneq");
@@ -1027,12 +1521,12 @@ public:
 				args.push_back(left);
 				args.push_back(right);
 
-				llvm::ArrayRef<llvm::Value*> argRef(args);
-				retval = builder.CreateCall(function, argRef, "call");
+				retval = createCall(function, args, builder, module);
 			}
 			else
 			{
-				auto* l = (left->getType()->isPointerTy() ? left->getType()->getPointerElementType() : left->getType());
+				// Assignments hold the pointer they store to on the left
+				auto* l = (binop->getOp() == "=" ? left->getType()->getPointerElementType() : left->getType());
 				matchTypes(type2str(l), type2str(right->getType()), binop->getRight().get());
 			}
 			
@@ -1067,7 +1561,10 @@ public:
 						break;
 					
 					case '@':
-						operand = static_cast<llvm::LoadInst*>(operand)->getPointerOperand();
+					{
+						auto* load = static_cast<llvm::LoadInst*>(operand);
+						operand = load->getPointerOperand();
+						eraseDeadLoad(load);
 						if(operand->getType()->isPointerTy())
 						{
 							retval = builder.CreateGEP(operand->getType()->getPointerElementType(), operand, builder.getInt32(0), "@gep");
@@ -1077,6 +1574,7 @@ public:
 							error("Can not take the address of a literal", op->getLocation());
 							//llvm::report_fatal_error("Can't take the address of a literal!");
 						break;
+					}
 						
 					case '$':
 						if(operand->getType()->isPointerTy())
@@ -1113,34 +1611,23 @@ public:
 				error("undefined variable '" + var->getName() + "'", var->getLocation());
 			}
 			
+			bool atomic = (AtomicValues.count(v) > 0);
 			
-			if(var->getIndex() != 0 && !v->getType()->isPointerTy())
-			{
-				error("can not index scalar values", var->getLocation());
-				return nullptr;
-			}
-			else if(var->getIndex() != nullptr)
-			{
-				auto index = var->getIndex();
-				llvm::Value* indexValue = generateIr(index, scope, builder, module);
-				if(!indexValue)
-					return nullptr;
-				
-				if(!v->getType()->getPointerElementType()->isArrayTy())
-					v = builder.CreateGEP(var2val(builder, v), var2val(builder, indexValue), "array_gep");
-				else
-				{
-					auto pelem = v->getType()->getPointerElementType()->getArrayElementType()->getPointerTo();//->dump();
-					v = builder.CreateGEP(v, var2val(builder, indexValue), "pointer_array_gep");
-					v = builder.CreatePointerCast(v, pelem, "pointercast");
-				}
-			}
-			
+			// The index belongs to the last field of a.b[i]
+			auto index = var->getIndex();
+
+			// Outermost class of the field path and the offset into it
+			llvm::StructType* base = nullptr;
+			uint64_t offset = 0;
+
 			while(var->getField())
 			{
 				if(!llvm::isa<llvm::StructType>(v->getType()->getPointerElementType()))
 				{
-					v = builder.CreateLoad(v, var->getName() + "_implicit_deref");
+					auto* deref = builder.CreateLoad(v, var->getName() + "_implicit_deref");
+					annotateTbaa(deref, base, offset, module);
+					v = deref;
+					base = nullptr;
 					if(!llvm::isa<llvm::StructType>(v->getType()->getPointerElementType()))
 					{
 						error("can not access a field of a non-class object", var->getLocation());
@@ -1174,13 +1661,67 @@ public:
 
 				int fieldIndex = classdef->getMemberIdx(field->getName());
 				llvm::Type* fieldType = getType(builder, fieldDef->getType(), module);
+				atomic = fieldDef->getAtomic();
+				if(fieldDef->getSize() > 0)
+					fieldType = llvm::ArrayType::get(fieldType, fieldDef->getSize());
 
-				v = builder.CreateGEP(v, builder.getInt32(fieldIndex), field->getName() + "_gep");
+				// Fields read through a different type fall back to scalar tags
+				if(fieldType != structType->getElementType(fieldIndex))
+					base = nullptr;
+				else
+				{
+					if(!base)
+					{
+						base = structType;
+						offset = 0;
+					}
+					offset += module->getDataLayout().getStructLayout(structType)->getElementOffset(fieldIndex);
+				}
+
+				v = builder.CreateStructGEP(structType, v, fieldIndex, field->getName() + "_gep");
 				v = builder.CreatePointerCast(v, fieldType->getPointerTo(), field->getName() + "_cast");
 				var = field;
 			}
+
+			llvm::Value* slice = nullptr;
+			if(index && !v->getType()->isPointerTy())
+			{
+				error("can not index scalar values", var->getLocation());
+				return nullptr;
+			}
+			else if(index)
+			{
+				// Elements are tagged by their type alone
+				base = nullptr;
+				llvm::Value* indexValue = generateIr(index, scope, builder, module);
+				if(!indexValue)
+					return nullptr;
+				
+				if(isSlice(v->getType()->getPointerElementType()))
+				{
+					slice = v;
+					auto sliceType = llvm::cast<llvm::StructType>(v->getType()->getPointerElementType());
+					llvm::Type* elementType = sliceType->getElementType(0)->getPointerElementType();
+					llvm::Value* data = builder.CreateLoad(sliceType->getElementType(0), builder.CreateStructGEP(sliceType, v, 0, "slice_data_ptr"), "slice_data");
+					v = builder.CreateInBoundsGEP(elementType, data, var2val(builder, indexValue), "slice_gep");
+				}
+				else if(!v->getType()->getPointerElementType()->isArrayTy())
+					v = builder.CreateGEP(var2val(builder, v), var2val(builder, indexValue), "array_gep");
+				else
+				{
+					// Step over the array itself first, then to the element
+					llvm::Value* indices[] = { builder.getInt32(0), var2val(builder, indexValue) };
+					v = builder.CreateInBoundsGEP(v->getType()->getPointerElementType(), v, indices, "pointer_array_gep");
+				}
+			}
 			
-			return builder.CreateLoad(v, var->getName());
+			auto* load = builder.CreateLoad(v, var->getName());
+			if(atomic)
+				load->setAtomic(llvm::AtomicOrdering::SequentiallyConsistent);
+			if(slice)
+				annotateRestrict(load, slice);
+			annotateTbaa(load, base, offset, module);
+			return load;
 		}
 		
 		if(auto var = dynamic_cast<VariableDef*>(k.get()))
@@ -1193,6 +1734,12 @@ public:
 				return nullptr;
 			}
 
+			if(!scope.isTopLevel() && var->getThreadLocal())
+			{
+				error("only global variables can be thread local", var->getLocation());
+				return nullptr;
+			}
+
 			if(scope.isTopLevel() && var->getExtern())
 			{
 				if(var->getInitial())
@@ -1211,8 +1758,14 @@ public:
 				if (var->getSize() > 0)
 					type = llvm::ArrayType::get(type, var->getSize());
 
+				if(var->getAtomic() && !checkAtomicType(type, var))
+					return nullptr;
+
 				llvm::GlobalVariable* global = static_cast<llvm::GlobalVariable*>(module->getOrInsertGlobal(var->getName(), type));
 				global->setLinkage(llvm::GlobalValue::ExternalLinkage);
+				setThreadLocal(var, global);
+				if(var->getAtomic())
+					AtomicValues.insert(global);
 				return global;
 			}
 
@@ -1225,7 +1778,7 @@ public:
 				// For local variables
 				if(!scope.isTopLevel())
 				{
-					llvm::Value* llvmVar = builder.CreateAlloca(initial->getType(), 0, var->getName());
+					llvm::Value* llvmVar = createLocal(builder, initial->getType(), var->getName());
 
 					scope.current()[var->getName()] = llvmVar;
 					return builder.CreateStore(initial, llvmVar, "var_init");
@@ -1247,7 +1800,7 @@ public:
 					llvm::GlobalVariable* global = static_cast<llvm::GlobalVariable*>(module->getOrInsertGlobal(var->getName(), initial->getType()));
 					global->setInitializer(constant);
 
-					global->setLinkage(llvm::GlobalValue::CommonLinkage);
+					setGlobalLinkage(var, global);
 					return global;
 				}
 			}
@@ -1265,21 +1818,26 @@ public:
 					return nullptr;
 				}
 
+				if (var->getSize() > 0)
+					type = llvm::ArrayType::get(type, var->getSize());
+
 				if(initial && initial->getType() != type)
 				{
 					error("variable type mismatch, expected " + type2str(type) + " but got " + type2str(initial->getType()), var->getInitial()->getLocation());
 					return nullptr;
 				}
 
-				if (var->getSize() > 0)
-					type = llvm::ArrayType::get(type, var->getSize());
+				if(var->getAtomic() && !checkAtomicType(type, var))
+					return nullptr;
 
 				// For local variables
 				if(!scope.isTopLevel())
 				{
 					llvm::Value* llvmVar = nullptr;
-					llvmVar = builder.CreateAlloca(type, 0, var->getName());
+					llvmVar = createLocal(builder, type, var->getName());
 					scope.current()[var->getName()] = llvmVar;
+					if(var->getAtomic())
+						AtomicValues.insert(llvmVar);
 					return (initial ? builder.CreateStore(initial, llvmVar, "var_init_typed") : llvmVar);
 				}
 				else // For global variables
@@ -1306,7 +1864,9 @@ public:
 					else
 						global->setInitializer(llvm::ConstantAggregateZero::get(type));
 
-					global->setLinkage(llvm::GlobalValue::CommonLinkage);
+					setGlobalLinkage(var, global);
+					if(var->getAtomic())
+						AtomicValues.insert(global);
 
 					return global;
 				}
@@ -1375,12 +1935,24 @@ public:
 			auto branch = builder.CreateCondBr(var2val(builder, condition), while_true, while_continue);
 			builder.SetInsertPoint(while_true);
 			generateIr(whily->getBody(), scope, builder, module);
-			builder.CreateBr(while_cond);
+			setLoopMetadata(builder.CreateBr(while_cond), whily, false);
 			
 			builder.SetInsertPoint(while_continue);
 			return branch;
 		}
 		
+		if(auto fory = dynamic_cast<ParallelFor*>(k.get()))
+		{
+			scope.exit();
+			return generateParallelFor(fory, scope, builder, module);
+		}
+
+		if(auto fory = dynamic_cast<RangeFor*>(k.get()))
+		{
+			scope.exit();
+			return generateRangeFor(fory, scope, builder, module);
+		}
+
 		if(auto fory = dynamic_cast<For*>(k.get()))
 		{
 			scope.exit();
@@ -1404,7 +1976,7 @@ public:
 			builder.SetInsertPoint(for_true);
 			generateIr(fory->getBody(), scope, builder, module);
 			generateIr(fory->getInc(), scope, builder, module);
-			builder.CreateBr(for_cond);
+			setLoopMetadata(builder.CreateBr(for_cond), fory, false);
 			
 			builder.SetInsertPoint(for_continue);
 			return branch;
@@ -1412,12 +1984,18 @@ public:
 
 		if(auto var = dynamic_cast<ClassDef*>(k.get()))
 		{
-			if(scope.Classes.find(var->getName()) != scope.Classes.end())
+			if(var->isTemplate())
 			{
-				error("class '" + var->getName() + "' is already defined", var->getLocation());
+				scope.exit();
 				return nullptr;
 			}
-			
+
+			if(scope.Classes.find(var->getName()) != scope.Classes.end())
+			{
+				error("class '" + var->getName() + "' is already defined", var->getLocation());
+				return nullptr;
+			}
+			
 			// Create type first
 			llvm::StructType* type = llvm::StructType::create(context, var->getName());
 			scope.Classes[var->getName()] = std::dynamic_pointer_cast<ClassDef>(k);
@@ -1427,8 +2005,17 @@ public:
 			// First, build data fields
 			for(auto& vardef : var->getFields())
 			{
-				if(vardef->getType() != var->getName())
-					members.push_back(getType(builder, vardef->getType(), module));
+				if(vardef->getType() == var->getName())
+					continue;
+
+				llvm::Type* type = getType(builder, vardef->getType(), module);
+				if(vardef->getSize() > 0)
+					type = llvm::ArrayType::get(type, vardef->getSize());
+
+				if(vardef->getAtomic())
+					checkAtomicType(type, vardef.get());
+
+				members.push_back(type);
 			}
 			
 			llvm::ArrayRef<llvm::Type*> membersRef(members);
@@ -1460,6 +2047,81 @@ public:
 			return builder.CreateBr(target);
 		}
 		
+		if(auto list = dynamic_cast<ValueList*>(k.get()))
+		{
+			// Small enough to come back in registers
+			std::vector<llvm::Value*> values;
+			std::vector<llvm::Type*> types;
+			for(auto& v : list->getValues())
+			{
+				llvm::Value* value = generateIr(v, scope, builder, module);
+				if(!value)
+				{
+					scope.exit();
+					return nullptr;
+				}
+
+				values.push_back(value);
+				types.push_back(value->getType());
+			}
+
+			scope.exit();
+			llvm::Value* result = llvm::UndefValue::get(llvm::StructType::get(context, types));
+			for(unsigned int i = 0; i < values.size(); i++)
+				result = builder.CreateInsertValue(result, values[i], i, "results");
+			return result;
+		}
+
+		if(auto unpack = dynamic_cast<Unpack*>(k.get()))
+			return generateUnpack(unpack, scope, builder, module);
+
+		if(auto array = dynamic_cast<ArrayLiteral*>(k.get()))
+		{
+			std::vector<llvm::Value*> values;
+			for(auto& v : array->getValues())
+			{
+				llvm::Value* value = generateIr(v, scope, builder, module);
+				if(!value)
+				{
+					scope.exit();
+					return nullptr;
+				}
+
+				if(!values.empty() && values[0]->getType() != value->getType())
+				{
+					error("array element type mismatch, expected '" + type2str(values[0]->getType())
+						+ "' but got '" + type2str(value->getType()) + "'", v->getLocation());
+					scope.exit();
+					return nullptr;
+				}
+
+				values.push_back(value);
+			}
+
+			scope.exit();
+			if(values.empty())
+			{
+				error("array literals can not be empty", array->getLocation());
+				return nullptr;
+			}
+
+			llvm::ArrayType* type = llvm::ArrayType::get(values[0]->getType(), values.size());
+
+			std::vector<llvm::Constant*> constants;
+			for(auto* v : values)
+				if(auto* c = llvm::dyn_cast<llvm::Constant>(v))
+					constants.push_back(c);
+
+			if(constants.size() == values.size())
+				return llvm::ConstantArray::get(type, constants);
+
+			llvm::Value* result = llvm::UndefValue::get(type);
+			for(unsigned int i = 0; i < values.size(); i++)
+				result = builder.CreateInsertValue(result, values[i], i, "array_insert");
+
+			return result;
+		}
+
 		if(auto var = dynamic_cast<Number*>(k.get()))
 		{
 			scope.exit();
@@ -1469,18 +2131,37 @@ public:
 		if(auto cast = dynamic_cast<TypeCast*>(k.get()))
 		{
 			// Cast!
-			if(llvm::Type* type = getType(builder, cast->getType()))
+			if(llvm::Type* type = getType(builder, cast->getType(), module))
 			{
 				auto value = cast->getValue();
 				llvm::Value* arg = generateIr(value, scope, builder, module);
 				if(!arg)
 					return nullptr;
 				
-				if(type->isPointerTy())
+				if(type->isPointerTy() && arg->getType()->isIntegerTy())
+				{
+					scope.exit();
+					return builder.CreateIntToPtr(arg, type, "int_to_pointer");
+				}
+				else if(type->isIntegerTy() && arg->getType()->isPointerTy())
+				{
+					scope.exit();
+					return builder.CreatePtrToInt(arg, type, "pointer_to_int");
+				}
+				else if(type->isPointerTy())
 				{
 					scope.exit();
 					return builder.CreatePointerCast(arg, type, "pointer_cast");
 				}
+				else if(type->isIntegerTy() && arg->getType()->isIntegerTy())
+				{
+					if(arg->getType()->getIntegerBitWidth() > type->getIntegerBitWidth())
+						warning("converting '" + type2str(arg->getType())
+							+ "' to '" + type2str(type) + "' loses precision", cast->getLocation());
+
+					scope.exit();
+					return builder.CreateSExtOrTrunc(arg, type, "int_cast");
+				}
 				else
 				{
 					if(!arg->getType()->canLosslesslyBitCastTo(type))
@@ -1494,142 +2175,2046 @@ public:
 			scope.exit();
 		}
 		
-		if(auto var = dynamic_cast<Integer*>(k.get()))
+		if(auto var = dynamic_cast<Integer*>(k.get()))
+		{
+			scope.exit();
+			return llvm::ConstantInt::get(context, llvm::APInt(32, var->getValue(), true));
+		}
+		
+		if(auto var = dynamic_cast<Bool*>(k.get()))
+		{
+			scope.exit();
+			return llvm::ConstantInt::get(context, llvm::APInt(1, var->getValue(), true));
+		}
+		
+		if(auto var = dynamic_cast<Byte*>(k.get()))
+		{
+			scope.exit();
+			return llvm::ConstantInt::get(context, llvm::APInt(8, var->getValue(), true));
+		}
+		
+		if(auto var = dynamic_cast<String*>(k.get()))
+		{
+			scope.exit();
+			llvm::GlobalVariable* str = builder.CreateGlobalString(var->getValue(), "string");
+			str->setConstant(false);
+			
+			llvm::Value* zero = llvm::ConstantInt::get(llvm::Type::getInt32Ty(context), 0);
+			llvm::Value* Args[] = { zero, zero };
+			return builder.CreateInBoundsGEP(str->getValueType(), str, Args, "string_literal_gep");
+		}
+		
+		if(auto yield = dynamic_cast<Yield*>(k.get()))
+		{
+			scope.exit();
+			return generateYield(yield->getValue(), yield, scope, builder, module);
+		}
+
+		if(auto await = dynamic_cast<Await*>(k.get()))
+		{
+			scope.exit();
+			return generateAwait(await, scope, builder, module);
+		}
+
+		if(auto ret = dynamic_cast<Return*>(k.get()))
+		{
+			if(ret->isTail())
+			{
+				scope.exit();
+				return generateTailCall(ret, scope, builder, module);
+			}
+
+			if(CurrentCoroutine)
+			{
+				scope.exit();
+				return generateYield(ret->getValue(), ret, scope, builder, module);
+			}
+
+			if(!ret->getValue())
+			{
+				scope.exit();
+				return builder.CreateRetVoid();
+			}
+
+			llvm::Value* retval = generateIr(ret->getValue(), scope, builder, module);
+			if(!retval) return nullptr;
+			
+			auto value = createReturn(retval, builder, module);
+			scope.exit();
+			return value;
+		}
+		
+		if(auto call = dynamic_cast<FunctionCall*>(k.get()))
+		{
+			// Handle include
+			if(call->getName() == "include")
+				return nullptr;
+
+			if(isBuiltin(call->getName()))
+			{
+				scope.exit();
+				return generateBuiltin(call, scope, builder, module);
+			}
+			
+			std::vector<llvm::Value*> args;	
+			for(auto& p : call->getArgs()) //args.push_back(var2val(builder, generateIr(p, scope, builder, module)));
+			{
+				llvm::Value* value = generateIr(p, scope, builder, module);
+				if(!value) return nullptr;
+				args.push_back(value);
+			}
+			
+			std::string funcname = call->getName();
+			if(call->isMethod())
+			{
+				llvm::Value* self = args[0];
+				
+				if(self->getType()->isPointerTy())
+					funcname = type2str(self->getType()->getPointerElementType()) + "_" + funcname;
+				else
+				{
+					funcname = type2str(self->getType()) + "_" + funcname;
+					args[0] = generateIr(std::make_shared<UnaryOp>(call->getArgs()[0], "@"), scope, builder, module);
+				}
+			}
+			
+			llvm::Function* calleeFunc = module->getFunction(funcname);
+			if(!calleeFunc && !call->isMethod())
+			{
+				Function* function = findFunction(funcname);
+				if(function && function->isTemplate())
+				{
+					calleeFunc = instantiateFunction(function, call, args, scope, builder, module);
+					if(!calleeFunc)
+						return nullptr;
+				}
+			}
+
+			if(!calleeFunc)
+			{
+				error("undefined function '" + call->getName() + "'", call->getLocation());
+				return nullptr;
+			}
+			
+			// Check types
+			{
+				llvm::FunctionType* calleeType = getSourceType(calleeFunc);
+				if(!calleeType->isVarArg() && calleeType->getNumParams() != args.size())
+				{
+					error("argument count mismatch, required " 
+						+ std::to_string(calleeType->getNumParams())
+						+ " but given " + std::to_string(args.size()), call->getLocation());
+					return nullptr;
+				}
+				
+				auto iter = args.begin();
+				size_t i = 0;
+				for(auto* param : calleeType->params())
+				{
+					if((*iter)->getType() != param)
+					{
+						error("argument type mismatch, expected '" 
+						+ type2str(param)
+						+ "' but got '" + type2str((*iter)->getType()), call->getArgs()[i]->getLocation());
+					
+						return nullptr;
+					}
+					
+					i++;
+					iter++;
+				}
+			}
+			
+			scope.exit();
+			return createCall(calleeFunc, args, builder, module);
+		}
+		
+		scope.exit();
+		return nullptr;
+	}
+	
+	void generateIr(std::vector<std::shared_ptr<Expr>>& expressions, LocalScope& scope, llvm::IRBuilder<>& builder, llvm::Module* module)
+	{
+		for(auto& k : expressions)
+		{
+			generateIr(k, scope, builder, module);
+		}
+	}
+
+	// Allocas outside of the entry block are not promoted to registers and grow the stack in loops
+	llvm::AllocaInst* createLocal(llvm::IRBuilder<>& builder, llvm::Type* type, const std::string& name)
+	{
+		llvm::BasicBlock& entry = builder.GetInsertBlock()->getParent()->getEntryBlock();
+		llvm::IRBuilder<> entryBuilder(&entry, entry.begin());
+		return entryBuilder.CreateAlloca(type, nullptr, name);
+	}
+
+	// Class values follow the x86-64 System V ABI: up to 16 bytes travel in integer and SSE
+	// registers, one per eightbyte, larger ones in memory through sret and byval pointers.
+	// Other targets keep the lowering LLVM applies to aggregates.
+	PassingConvention classify(llvm::Type* type, llvm::Module* module)
+	{
+		// Several results are no C type, LLVM returns them in as many registers as it can
+		auto structure = llvm::dyn_cast<llvm::StructType>(type);
+		if(!structure || structure->isLiteral() || llvm::Triple(module->getTargetTriple()).getArch() != llvm::Triple::x86_64)
+			return {PassingConvention::Direct, type};
+
+		const llvm::DataLayout& layout = module->getDataLayout();
+		uint64_t size = layout.getTypeAllocSize(type);
+		if(size == 0)
+			return {PassingConvention::Direct, type};
+
+		if(size > 16)
+			return {PassingConvention::Memory, type->getPointerTo()};
+
+		Eightbyte eightbytes[2];
+		classifyEightbytes(type, 0, eightbytes, layout);
+
+		std::vector<llvm::Type*> parts;
+		for(uint64_t offset = 0; offset < size; offset += 8)
+		{
+			uint64_t bytes = std::min<uint64_t>(8, size - offset);
+			Eightbyte& eightbyte = eightbytes[offset / 8];
+
+			// A lone pointer stays one, alias analysis can still follow it
+			if(!eightbyte.Floating && eightbyte.Fields == 1 && eightbyte.First->isPointerTy())
+				parts.push_back(eightbyte.First);
+			else if(!eightbyte.Floating)
+				parts.push_back(llvm::IntegerType::get(context, bytes * 8));
+			else if(eightbyte.Wide)
+				parts.push_back(llvm::Type::getDoubleTy(context));
+			else if(bytes <= 4)
+				parts.push_back(llvm::Type::getFloatTy(context));
+			else
+				parts.push_back(llvm::FixedVectorType::get(llvm::Type::getFloatTy(context), 2));
+		}
+
+		return {PassingConvention::Coerced, (parts.size() == 1 ? parts[0] : llvm::StructType::get(context, parts))};
+	}
+
+	// Parameters taking a value. Like clang, two eightbytes of a coerced class
+	// are separate arguments, only results travel as one {a, b} pair.
+	static std::vector<llvm::Type*> getLoweredParams(const PassingConvention& passing)
+	{
+		auto parts = llvm::dyn_cast<llvm::StructType>(passing.Type);
+		if(passing.How == PassingConvention::Coerced && parts)
+			return std::vector<llvm::Type*>(parts->element_begin(), parts->element_end());
+		return {passing.Type};
+	}
+
+	// Conventions of the parameters of a signature. Arguments take the 6 integer and 8 SSE
+	// registers in order, an sret pointer the first integer one. Like clang, a class that
+	// does not find a register for each of its eightbytes is passed in memory as a whole.
+	std::vector<PassingConvention> classifyParams(llvm::Type* result, llvm::ArrayRef<llvm::Type*> params, llvm::Module* module)
+	{
+		int freeInt = (classify(result, module).How == PassingConvention::Memory ? 5 : 6);
+		int freeSse = 8;
+
+		std::vector<PassingConvention> conventions;
+		for(auto* param : params)
+		{
+			PassingConvention passing = classify(param, module);
+			if(passing.How == PassingConvention::Memory || (passing.How == PassingConvention::Direct && !passing.Type->isSingleValueType()))
+			{
+				conventions.push_back(passing);
+				continue;
+			}
+
+			int needInt = 0, needSse = 0;
+			for(auto* part : getLoweredParams(passing))
+				(part->isFloatingPointTy() || part->isVectorTy() ? needSse : needInt)++;
+
+			if(passing.How == PassingConvention::Coerced && (needInt > freeInt || needSse > freeSse))
+				passing = {PassingConvention::Memory, param->getPointerTo()};
+			else
+			{
+				// Scalars without a register left go to the stack on their own
+				freeInt = std::max(0, freeInt - needInt);
+				freeSse = std::max(0, freeSse - needSse);
+			}
+
+			conventions.push_back(passing);
+		}
+		return conventions;
+	}
+
+	struct Eightbyte
+	{
+		bool Floating = true; // Goes to an SSE register if it only holds float and double fields
+		bool Wide = false; // Holds a double
+		unsigned int Fields = 0;
+		llvm::Type* First = nullptr;
+	};
+
+	void classifyEightbytes(llvm::Type* type, uint64_t offset, Eightbyte* eightbytes, const llvm::DataLayout& layout)
+	{
+		if(auto structure = llvm::dyn_cast<llvm::StructType>(type))
+		{
+			const llvm::StructLayout* fields = layout.getStructLayout(structure);
+			for(unsigned int i = 0; i < structure->getNumElements(); i++)
+				classifyEightbytes(structure->getElementType(i), offset + fields->getElementOffset(i), eightbytes, layout);
+			return;
+		}
+
+		if(auto array = llvm::dyn_cast<llvm::ArrayType>(type))
+		{
+			uint64_t stride = layout.getTypeAllocSize(array->getElementType());
+			for(uint64_t i = 0; i < array->getNumElements(); i++)
+				classifyEightbytes(array->getElementType(), offset + i * stride, eightbytes, layout);
+			return;
+		}
+
+		Eightbyte& eightbyte = eightbytes[offset / 8];
+		if(eightbyte.Fields++ == 0)
+			eightbyte.First = type;
+
+		if(type->isDoubleTy())
+			eightbyte.Wide = true;
+		else if(!type->isFloatTy())
+			eightbyte.Floating = false;
+	}
+
+	void applyPassingAttributes(llvm::Function* function, llvm::FunctionType* sourceType, llvm::Module* module)
+	{
+		const llvm::DataLayout& layout = module->getDataLayout();
+		unsigned int first = 0;
+		if(function->getReturnType()->isVoidTy() && !sourceType->getReturnType()->isVoidTy())
+		{
+			function->addParamAttr(0, llvm::Attribute::getWithStructRetType(context, sourceType->getReturnType()));
+			function->addParamAttr(0, llvm::Attribute::NoAlias);
+			first = 1;
+		}
+
+		auto conventions = classifyParams(sourceType->getReturnType(), sourceType->params(), module);
+		for(unsigned int i = 0, param = first; i < sourceType->getNumParams(); i++)
+		{
+			llvm::Type* type = sourceType->getParamType(i);
+			if(conventions[i].How == PassingConvention::Memory)
+			{
+				function->addParamAttr(param, llvm::Attribute::getWithByValType(context, type));
+				function->addParamAttr(param, llvm::Attribute::getWithAlignment(context, std::max(llvm::Align(8), layout.getABITypeAlign(type))));
+			}
+			param += getLoweredParams(conventions[i]).size();
+		}
+	}
+
+	llvm::FunctionType* getSourceType(llvm::Function* function)
+	{
+		auto type = SourceTypes.find(function);
+		return (type != SourceTypes.end() ? type->second : function->getFunctionType());
+	}
+
+	// Memory big enough and aligned for both views of a value
+	llvm::AllocaInst* createCoercionLocal(llvm::IRBuilder<>& builder, llvm::Type* a, llvm::Type* b, llvm::Module* module)
+	{
+		const llvm::DataLayout& layout = module->getDataLayout();
+		llvm::AllocaInst* local = createLocal(builder, (layout.getTypeAllocSize(a) >= layout.getTypeAllocSize(b) ? a : b), "coerced");
+		local->setAlignment(std::max(layout.getABITypeAlign(a), layout.getABITypeAlign(b)));
+		return local;
+	}
+
+	// Turns a class value into what the signature passes instead
+	llvm::Value* lowerValue(llvm::Value* value, llvm::Type* lowered, llvm::IRBuilder<>& builder, llvm::Module* module)
+	{
+		if(lowered->isPointerTy())
+		{
+			llvm::AllocaInst* copy = createLocal(builder, value->getType(), "byval");
+			copy->setAlignment(std::max(llvm::Align(8), module->getDataLayout().getABITypeAlign(value->getType())));
+			builder.CreateStore(value, copy);
+			return copy;
+		}
+
+		llvm::AllocaInst* local = createCoercionLocal(builder, value->getType(), lowered, module);
+		builder.CreateStore(value, builder.CreateBitCast(local, value->getType()->getPointerTo()));
+		return builder.CreateLoad(lowered, builder.CreateBitCast(local, lowered->getPointerTo()), "coerced_value");
+	}
+
+	// Reverses lowerValue
+	llvm::Value* raiseValue(llvm::Value* value, llvm::Type* type, llvm::IRBuilder<>& builder, llvm::Module* module)
+	{
+		if(value->getType() == type->getPointerTo())
+			return builder.CreateLoad(type, value, "byval_value");
+
+		llvm::AllocaInst* local = createCoercionLocal(builder, value->getType(), type, module);
+		builder.CreateStore(value, builder.CreateBitCast(local, value->getType()->getPointerTo()));
+		return builder.CreateLoad(type, builder.CreateBitCast(local, type->getPointerTo()), "class_value");
+	}
+
+	llvm::Value* createCall(llvm::Function* function, const std::vector<llvm::Value*>& args, llvm::IRBuilder<>& builder, llvm::Module* module)
+	{
+		llvm::FunctionType* source = getSourceType(function);
+		llvm::FunctionType* lowered = function->getFunctionType();
+		if(source == lowered)
+			return builder.CreateCall(function, args, (lowered->getReturnType()->isVoidTy() ? "" : "call"));
+
+		std::vector<llvm::Value*> loweredArgs;
+		llvm::AllocaInst* result = nullptr;
+		if(function->hasStructRetAttr())
+		{
+			result = createLocal(builder, source->getReturnType(), "call_result");
+			loweredArgs.push_back(result);
+		}
+
+		auto conventions = classifyParams(source->getReturnType(), source->params(), module);
+		for(size_t i = 0; i < args.size(); i++)
+		{
+			PassingConvention passing = (i < conventions.size() ? conventions[i] : PassingConvention{PassingConvention::Direct, args[i]->getType()});
+			if(passing.How == PassingConvention::Direct)
+			{
+				loweredArgs.push_back(args[i]);
+				continue;
+			}
+
+			llvm::Value* value = lowerValue(args[i], passing.Type, builder, module);
+			if(passing.How == PassingConvention::Coerced && passing.Type->isStructTy())
+			{
+				for(unsigned int j = 0; j < passing.Type->getStructNumElements(); j++)
+					loweredArgs.push_back(builder.CreateExtractValue(value, j));
+			}
+			else
+				loweredArgs.push_back(value);
+		}
+
+		llvm::CallInst* call = builder.CreateCall(function, loweredArgs);
+		call->setAttributes(function->getAttributes());
+
+		if(result)
+			return builder.CreateLoad(source->getReturnType(), result, "call");
+		if(source->getReturnType() != lowered->getReturnType())
+			return raiseValue(call, source->getReturnType(), builder, module);
+		if(!lowered->getReturnType()->isVoidTy())
+			call->setName("call");
+		return call;
+	}
+
+	llvm::Value* createReturn(llvm::Value* value, llvm::IRBuilder<>& builder, llvm::Module* module)
+	{
+		llvm::Function* function = builder.GetInsertBlock()->getParent();
+		if(function->hasStructRetAttr())
+		{
+			builder.CreateStore(value, function->getArg(0));
+			return builder.CreateRetVoid();
+		}
+
+		if(value->getType()->isStructTy() && value->getType() != function->getReturnType())
+			return builder.CreateRet(lowerValue(value, function->getReturnType(), builder, module));
+
+		return builder.CreateRet(value);
+	}
+
+	// The body is outlined into 'function(@void ctx, int begin, int end)' which the scheduler calls for
+	// every chunk. Locals of the enclosing function are passed by reference through ctx.
+	llvm::Value* generateParallelFor(ParallelFor* fory, LocalScope& scope, llvm::IRBuilder<>& builder, llvm::Module* module)
+	{
+		llvm::Function* scheduler = module->getFunction("lpp_parallel_for");
+		if(!scheduler)
+		{
+			error("parallel for needs require(\"parallel\")", fory->getLocation());
+			return nullptr;
+		}
+
+		auto init = static_cast<VariableDef*>(fory->getInit().get());
+		auto cond = static_cast<BinaryOp*>(fory->getCond().get());
+
+		llvm::Value* first = generateIr(init->getInitial(), scope, builder, module);
+		llvm::Value* last = generateIr(cond->getRight(), scope, builder, module);
+		llvm::Value* grain = (fory->getGrain() ? generateIr(fory->getGrain(), scope, builder, module) : builder.getInt32(0));
+		if(!first || !last || !grain)
+			return nullptr;
+
+		first = var2val(builder, first);
+		last = var2val(builder, last);
+		grain = var2val(builder, grain);
+		if(first->getType() != builder.getInt32Ty() || last->getType() != builder.getInt32Ty() || grain->getType() != builder.getInt32Ty())
+		{
+			error("the range and grain size of a parallel for have to be of type 'int'", fory->getLocation());
+			return nullptr;
+		}
+
+		// Everything the body could refer to, inner variables shadow outer ones
+		llvm::Function* parent = builder.GetInsertBlock()->getParent();
+		std::map<std::string, llvm::Value*> visible;
+		for(auto level = scope.LocalVariables.rbegin(); level != scope.LocalVariables.rend(); level++)
+		{
+			for(auto& k : **level)
+			{
+				auto inst = llvm::dyn_cast<llvm::Instruction>(k.second);
+				if(inst && inst->getFunction() == parent)
+					visible.insert(k);
+			}
+		}
+
+		std::vector<std::pair<std::string, llvm::Value*>> captures(visible.begin(), visible.end());
+		std::vector<llvm::Type*> fields;
+		for(auto& k : captures)
+			fields.push_back(k.second->getType());
+
+		llvm::StructType* ctxType = llvm::StructType::create(context, fields, parent->getName().str() + "_parallel_ctx");
+		llvm::FunctionType* bodyType = llvm::FunctionType::get(builder.getVoidTy(), {builder.getInt8PtrTy(), builder.getInt32Ty(), builder.getInt32Ty()}, false);
+		llvm::Function* body = llvm::Function::Create(bodyType, llvm::Function::InternalLinkage, parent->getName() + "_parallel", module);
+
+		std::vector<llvm::LoadInst*> loads;
+		{
+			llvm::IRBuilderBase::InsertPointGuard guard(builder);
+			builder.SetInsertPoint(llvm::BasicBlock::Create(context, "parallel_entry", body));
+
+			auto arg = body->arg_begin();
+			llvm::Value* ctx = builder.CreateBitCast(arg, ctxType->getPointerTo(), "ctx");
+			llvm::Value* begin = ++arg;
+			llvm::Value* end = ++arg;
+			begin->setName("begin");
+			end->setName("end");
+
+			LocalScope::Scope captured, locals;
+			for(unsigned int i = 0; i < captures.size(); i++)
+			{
+				auto load = builder.CreateLoad(ctxType->getElementType(i), builder.CreateStructGEP(ctxType, ctx, i), captures[i].first + "_capture");
+				captured[captures[i].first] = load;
+				loads.push_back(load);
+
+				if(AtomicValues.count(captures[i].second))
+					AtomicValues.insert(load);
+			}
+
+			LocalScope bodyScope = scope;
+			bodyScope.addLevel(&captured);
+			bodyScope.addLevel(&locals);
+
+			// Every chunk reduces into its own copy which is combined with the shared variable at the end
+			std::vector<std::pair<llvm::Value*, llvm::AllocaInst*>> reductions;
+			for(auto& reduction : fory->getReductions())
+			{
+				llvm::Value* shared = (captured.count(reduction.second) ? captured[reduction.second] : module->getNamedGlobal(reduction.second));
+				if(!shared)
+				{
+					error("undefined reduction variable '" + reduction.second + "'", fory->getLocation());
+					return nullptr;
+				}
+
+				llvm::Type* type = shared->getType()->getPointerElementType();
+				llvm::Constant* identity = getReductionIdentity(reduction.first, type);
+				if(!identity)
+				{
+					error("can not reduce '" + type2str(type) + "' with '" + reduction.first + "'", fory->getLocation());
+					return nullptr;
+				}
+
+				llvm::AllocaInst* partial = createLocal(builder, type, reduction.second + "_partial");
+				builder.CreateStore(identity, partial);
+				locals[reduction.second] = partial;
+				reductions.push_back({shared, partial});
+			}
+
+			llvm::Value* index = createLocal(builder, builder.getInt32Ty(), init->getName());
+			builder.CreateStore(begin, index);
+			locals[init->getName()] = index;
+
+			llvm::BasicBlock* parallel_cond = llvm::BasicBlock::Create(context, "parallel_cond", body);
+			llvm::BasicBlock* parallel_true = llvm::BasicBlock::Create(context, "parallel_true", body);
+			llvm::BasicBlock* parallel_done = llvm::BasicBlock::Create(context, "parallel_done", body);
+
+			builder.CreateBr(parallel_cond);
+			builder.SetInsertPoint(parallel_cond);
+			builder.CreateCondBr(builder.CreateICmpSLT(builder.CreateLoad(builder.getInt32Ty(), index, "index"), end, "more"), parallel_true, parallel_done);
+
+			// The body is not part of an enclosing coroutine and can not suspend it
+			Coroutine* outerCoroutine = CurrentCoroutine;
+			CurrentCoroutine = nullptr;
+
+			builder.SetInsertPoint(parallel_true);
+			generateIr(fory->getBody(), bodyScope, builder, module);
+			generateIr(fory->getInc(), bodyScope, builder, module);
+			CurrentCoroutine = outerCoroutine;
+			builder.CreateBr(parallel_cond);
+
+			builder.SetInsertPoint(parallel_done);
+			for(size_t i = 0; i < reductions.size(); i++)
+				generateReduction(fory->getReductions()[i].first, reductions[i].first, reductions[i].second, builder);
+			builder.CreateRetVoid();
+		}
+
+		// Only variables the body uses are captured, all others stay in registers
+		llvm::Value* ctx = createLocal(builder, ctxType, "parallel_ctx");
+		for(unsigned int i = 0; i < captures.size(); i++)
+		{
+			if(!loads[i]->use_empty())
+			{
+				builder.CreateStore(captures[i].second, builder.CreateStructGEP(ctxType, ctx, i));
+				continue;
+			}
+
+			auto address = llvm::cast<llvm::Instruction>(loads[i]->getPointerOperand());
+			AtomicValues.erase(loads[i]);
+			loads[i]->eraseFromParent();
+			address->eraseFromParent();
+		}
+
+		return builder.CreateCall(scheduler, {builder.CreateBitCast(body, builder.getInt8PtrTy(), "parallel_body"),
+											  builder.CreateBitCast(ctx, builder.getInt8PtrTy(), "parallel_ctx_ptr"),
+											  first, last, grain});
+	}
+
+	llvm::Constant* getReductionIdentity(const std::string& op, llvm::Type* type)
+	{
+		if(type->isFloatingPointTy())
+		{
+			if(op == "+")
+				return llvm::ConstantFP::get(type, 0.0);
+			if(op == "*")
+				return llvm::ConstantFP::get(type, 1.0);
+		}
+		else if(type->isIntegerTy() && type->getIntegerBitWidth() >= 8)
+		{
+			if(op == "+" || op == "|" || op == "^")
+				return llvm::ConstantInt::get(type, 0);
+			if(op == "*")
+				return llvm::ConstantInt::get(type, 1);
+			if(op == "&")
+				return llvm::ConstantInt::getAllOnesValue(type);
+		}
+		return nullptr;
+	}
+
+	void generateReduction(const std::string& op, llvm::Value* shared, llvm::AllocaInst* partial, llvm::IRBuilder<>& builder)
+	{
+		llvm::Value* value = builder.CreateLoad(partial->getAllocatedType(), partial, "partial");
+		const bool isFloat = value->getType()->isFloatingPointTy();
+		const auto ordering = llvm::AtomicOrdering::SequentiallyConsistent;
+
+		if(op != "*")
+		{
+			auto operation = (op == "+" ? (isFloat ? llvm::AtomicRMWInst::FAdd : llvm::AtomicRMWInst::Add)
+							  : op == "&" ? llvm::AtomicRMWInst::And
+							  : op == "|" ? llvm::AtomicRMWInst::Or : llvm::AtomicRMWInst::Xor);
+			builder.CreateAtomicRMW(operation, shared, value, llvm::MaybeAlign(), ordering);
+			return;
+		}
+
+		// There is no atomic multiplication, retry until no other chunk got in between
+		llvm::Type* bitsType = builder.getIntNTy(value->getType()->getPrimitiveSizeInBits());
+		llvm::Value* address = builder.CreatePointerCast(shared, bitsType->getPointerTo(), "reduce_address");
+		llvm::LoadInst* initial = builder.CreateLoad(bitsType, address, "reduce_initial");
+		initial->setAtomic(llvm::AtomicOrdering::Monotonic);
+
+		llvm::Function* function = builder.GetInsertBlock()->getParent();
+		llvm::BasicBlock* reduce_entry = builder.GetInsertBlock();
+		llvm::BasicBlock* reduce_retry = llvm::BasicBlock::Create(context, "reduce_retry", function);
+		llvm::BasicBlock* reduce_done = llvm::BasicBlock::Create(context, "reduce_done", function);
+
+		builder.CreateBr(reduce_retry);
+		builder.SetInsertPoint(reduce_retry);
+		llvm::PHINode* seen = builder.CreatePHI(bitsType, 2, "reduce_seen");
+		llvm::Value* old = builder.CreateBitCast(seen, value->getType(), "reduce_old");
+		llvm::Value* product = (isFloat ? builder.CreateFMul(old, value, "fmul") : builder.CreateMul(old, value, "mul"));
+		llvm::Value* pair = builder.CreateAtomicCmpXchg(address, seen, builder.CreateBitCast(product, bitsType, "reduce_bits"),
+														llvm::MaybeAlign(), ordering, ordering);
+		llvm::Value* observed = builder.CreateExtractValue(pair, 0, "reduce_observed");
+
+		seen->addIncoming(initial, reduce_entry);
+		seen->addIncoming(observed, builder.GetInsertBlock());
+		builder.CreateCondBr(builder.CreateExtractValue(pair, 1, "reduce_success"), reduce_done, reduce_retry);
+		builder.SetInsertPoint(reduce_done);
+	}
+
+	static bool isBuiltin(const std::string& name)
+	{
+		static const std::unordered_set<std::string> builtins = {
+			"sizeof", "new", "slice", "len",
+			"atomic_load", "atomic_store", "atomic_exchange", "atomic_compare_exchange",
+			"atomic_fetch_add", "atomic_fetch_sub", "atomic_fetch_and", "atomic_fetch_or", "atomic_fetch_xor",
+			"atomic_fence",
+			"coroutine_resume", "coroutine_done", "coroutine_destroy", "coroutine_value", "coroutine_self"
+		};
+		return builtins.count(name) > 0;
+	}
+
+	llvm::Value* generateUnpack(Unpack* unpack, LocalScope& scope, llvm::IRBuilder<>& builder, llvm::Module* module)
+	{
+		auto& targets = unpack->getTargets();
+		std::vector<llvm::Value*> values;
+		for(auto& v : unpack->getValues())
+		{
+			llvm::Value* value = generateIr(v, scope, builder, module);
+			if(!value)
+			{
+				scope.exit();
+				return nullptr;
+			}
+
+			values.push_back(value);
+		}
+
+		// A single value provides all results of a function returning several
+		auto results = llvm::dyn_cast<llvm::StructType>(values[0]->getType());
+		if(values.size() == 1 && targets.size() > 1 && results && results->isLiteral() && results->getNumElements() == targets.size())
+		{
+			llvm::Value* result = values[0];
+			values.clear();
+			for(unsigned int i = 0; i < targets.size(); i++)
+				values.push_back(builder.CreateExtractValue(result, i, "result"));
+		}
+
+		// Declarations are visible to the parent scope
+		scope.exit();
+		if(values.size() != targets.size())
+		{
+			error("expected " + std::to_string(targets.size()) + " values but got " + std::to_string(values.size()), unpack->getLocation());
+			return nullptr;
+		}
+
+		llvm::Value* last = nullptr;
+		for(unsigned int i = 0; i < targets.size(); i++)
+		{
+			if(unpack->isDeclaration())
+			{
+				const std::string& name = static_cast<Variable*>(targets[i].get())->getName();
+				if(scope.isTopLevel())
+				{
+					error("only local variables can be defined from several results", targets[i]->getLocation());
+					return nullptr;
+				}
+
+				if(scope.current().find(name) != scope.current().end())
+				{
+					error("variable name collision", targets[i]->getLocation());
+					return nullptr;
+				}
+
+				llvm::Value* local = createLocal(builder, values[i]->getType(), name);
+				scope.current()[name] = local;
+				last = builder.CreateStore(values[i], local);
+				continue;
+			}
+
+			auto load = llvm::dyn_cast_or_null<llvm::LoadInst>(generateIr(targets[i], scope, builder, module));
+			if(!load)
+			{
+				error("left assignment operand is not a variable", targets[i]->getLocation());
+				return nullptr;
+			}
+
+			if(load->getType() != values[i]->getType())
+			{
+				error("assignment expected '" + type2str(load->getType()) + "' but got '" + type2str(values[i]->getType()) + "'",
+					targets[i]->getLocation());
+				return nullptr;
+			}
+
+			auto store = builder.CreateStore(values[i], load->getPointerOperand());
+			if(load->isAtomic())
+				store->setAtomic(load->getOrdering());
+			store->copyMetadata(*load, {llvm::LLVMContext::MD_tbaa, llvm::LLVMContext::MD_alias_scope, llvm::LLVMContext::MD_noalias});
+
+			eraseDeadLoad(load);
+			last = store;
+		}
+
+		return last;
+	}
+
+	// Whether the value may be derived from an alloca of the current function,
+	// looking through offsets, casts, integer round trips, selects and phis
+	static bool pointsToLocal(llvm::Value* value)
+	{
+		llvm::SmallVector<const llvm::Value*, 4> pending{value};
+		llvm::SmallPtrSet<const llvm::Value*, 8> visited;
+		while(!pending.empty())
+		{
+			const llvm::Value* current = pending.pop_back_val();
+			if(!visited.insert(current).second)
+				continue;
+
+			if(auto cast = llvm::dyn_cast<llvm::CastInst>(current))
+			{
+				pending.push_back(cast->getOperand(0));
+				continue;
+			}
+
+			if(!current->getType()->isPointerTy())
+				continue;
+
+			llvm::SmallVector<const llvm::Value*, 4> objects;
+			llvm::getUnderlyingObjects(current, objects);
+			for(auto object : objects)
+			{
+				if(llvm::isa<llvm::AllocaInst>(object))
+					return true;
+				else if(object != current)
+					pending.push_back(object);
+			}
+		}
+		return false;
+	}
+
+	// Emits a musttail call or explains why the callee cannot reuse the frame of the caller
+	llvm::Value* generateTailCall(Return* ret, LocalScope& scope, llvm::IRBuilder<>& builder, llvm::Module* module)
+	{
+		auto call = dynamic_cast<FunctionCall*>(ret->getValue().get());
+		if(!call || isBuiltin(call->getName()))
+		{
+			error("only function calls can be tail calls", ret->getLocation());
+			return nullptr;
+		}
+
+		if(CurrentCoroutine)
+		{
+			error("tail calls are not possible in async functions", ret->getLocation());
+			return nullptr;
+		}
+
+		llvm::Value* value = generateIr(ret->getValue(), scope, builder, module);
+		if(!value)
+			return nullptr;
+
+		llvm::Function* caller = builder.GetInsertBlock()->getParent();
+		auto result = llvm::dyn_cast<llvm::CallInst>(value);
+
+		// Calls through function pointers only have the prototype and attributes of the call site
+		llvm::Function* callee = (result ? result->getCalledFunction() : nullptr);
+		std::string calleeName = (callee ? callee->getName().str() : call->getName());
+
+		if(!result || caller->hasStructRetAttr() || caller->getAttributes().hasAttrSomewhere(llvm::Attribute::ByVal)
+			|| result->getAttributes().hasAttrSomewhere(llvm::Attribute::ByVal)
+			|| (callee && callee->getAttributes().hasAttrSomewhere(llvm::Attribute::ByVal)))
+		{
+			error("cannot guarantee a tail call, class values passed in memory or converted for the C ABI need the frame of the caller",
+				ret->getLocation());
+			return nullptr;
+		}
+
+		llvm::FunctionType* callerType = caller->getFunctionType();
+		llvm::FunctionType* calleeType = result->getFunctionType();
+
+		// musttail needs matching prototypes, pointers may point to different types
+		auto compatible = [](llvm::Type* a, llvm::Type* b) {
+			return a == b || (a->isPointerTy() && b->isPointerTy());
+		};
+
+		bool matching = !calleeType->isVarArg() && !callerType->isVarArg()
+				&& result->getCallingConv() == caller->getCallingConv()
+				&& calleeType->getNumParams() == callerType->getNumParams()
+				&& compatible(calleeType->getReturnType(), callerType->getReturnType());
+
+		for(unsigned int i = 0; matching && i < calleeType->getNumParams(); i++)
+			matching = compatible(calleeType->getParamType(i), callerType->getParamType(i));
+
+		if(!matching)
+		{
+			error("cannot guarantee a tail call from '" + caller->getName().str() + "' to '" + calleeName
+				+ "', their parameter and return types differ", ret->getLocation());
+			return nullptr;
+		}
+
+		// The frame of the caller is gone once the callee runs
+		for(unsigned int i = 0; i < result->arg_size(); i++)
+		{
+			if(pointsToLocal(result->getArgOperand(i)))
+			{
+				error("cannot guarantee a tail call to '" + calleeName + "', argument "
+					+ std::to_string(i + 1) + " points to a local variable", call->getArgs()[i]->getLocation());
+				return nullptr;
+			}
+		}
+
+		result->setTailCallKind(llvm::CallInst::TCK_MustTail);
+		if(callerType->getReturnType()->isVoidTy())
+			return builder.CreateRetVoid();
+
+		if(result->getType() != callerType->getReturnType())
+			return builder.CreateRet(builder.CreateBitCast(result, callerType->getReturnType()));
+
+		return builder.CreateRet(result);
+	}
+
+	llvm::Value* generateBuiltin(FunctionCall* call, LocalScope& scope, llvm::IRBuilder<>& builder, llvm::Module* module)
+	{
+		if(call->getName() == "sizeof")
+			return generateSizeof(call, builder, module);
+		else if(call->getName() == "new")
+			return generateNew(call, scope, builder, module);
+		else if(call->getName().compare(0, 10, "coroutine_") == 0)
+			return generateCoroutineBuiltin(call, scope, builder, module);
+		else if(call->getName() == "slice" || call->getName() == "len")
+			return generateSliceBuiltin(call, scope, builder, module);
+		return generateAtomic(call, scope, builder, module);
+	}
+
+	static bool isSlice(llvm::Type* type)
+	{
+		auto structure = llvm::dyn_cast<llvm::StructType>(type);
+		return structure && structure->hasName() && structure->getName().startswith("[]");
+	}
+
+	llvm::Value* createSlice(llvm::Value* data, llvm::Value* length, Expr* where, llvm::IRBuilder<>& builder, llvm::Module* module)
+	{
+		std::string name = "[]" + type2str(data->getType()->getPointerElementType());
+		llvm::Type* type = getType(builder, name, module);
+		if(!type)
+		{
+			error("can not create slices of type '" + name + "'", where->getLocation());
+			return nullptr;
+		}
+
+		llvm::Value* slice = builder.CreateInsertValue(llvm::UndefValue::get(type), data, 0, "slice");
+		return builder.CreateInsertValue(slice, length, 1, "slice");
+	}
+
+	// Slices and fixed arrays are both seen as data and length. Fixed arrays are used in place
+	// and range holds the variable of a restrict slice if the value was loaded from one.
+	bool getRange(llvm::Value* value, llvm::Value*& data, llvm::Value*& length, llvm::Value** range, llvm::IRBuilder<>& builder)
+	{
+		auto load = llvm::dyn_cast<llvm::LoadInst>(value);
+		if(load && load->getType()->isArrayTy())
+		{
+			llvm::Value* indices[] = { builder.getInt32(0), builder.getInt32(0) };
+			data = builder.CreateInBoundsGEP(load->getType(), load->getPointerOperand(), indices, "array_data");
+			length = builder.getInt32(load->getType()->getArrayNumElements());
+			eraseDeadLoad(load);
+			return true;
+		}
+
+		if(!isSlice(value->getType()))
+			return false;
+
+		data = builder.CreateExtractValue(value, 0, "slice_data");
+		length = builder.CreateExtractValue(value, 1, "slice_length");
+		if(range && load && RestrictScopes.count(load->getPointerOperand()))
+			*range = load->getPointerOperand();
+		return true;
+	}
+
+	// slice(array), slice(pointer, length), slice(array or slice, from, to) and len(array or slice)
+	llvm::Value* generateSliceBuiltin(FunctionCall* call, LocalScope& scope, llvm::IRBuilder<>& builder, llvm::Module* module)
+	{
+		auto& args = call->getArgs();
+		std::vector<llvm::Value*> values;
+		for(auto& arg : args)
+		{
+			llvm::Value* value = generateIr(arg, scope, builder, module);
+			if(!value)
+				return nullptr;
+			values.push_back(value);
+		}
+
+		if(values.empty() || values.size() > 3 || (call->getName() == "len" && values.size() != 1))
+		{
+			error("wrong number of arguments for '" + call->getName() + "'", call->getLocation());
+			return nullptr;
+		}
+
+		for(size_t i = 1; i < values.size(); i++)
+			if(!values[i]->getType()->isIntegerTy(32))
+			{
+				error("slice bounds have to be int", args[i]->getLocation());
+				return nullptr;
+			}
+
+		if(values.size() == 2)
+		{
+			if(!values[0]->getType()->isPointerTy())
+			{
+				error("slice(pointer, length) expects a pointer", args[0]->getLocation());
+				return nullptr;
+			}
+			return createSlice(values[0], values[1], call, builder, module);
+		}
+
+		llvm::Value* data = nullptr;
+		llvm::Value* length = nullptr;
+		if(!getRange(values[0], data, length, nullptr, builder))
+		{
+			error("expected a slice or an array", args[0]->getLocation());
+			return nullptr;
+		}
+
+		if(call->getName() == "len")
+			return length;
+
+		if(values.size() == 3)
+		{
+			data = builder.CreateInBoundsGEP(data->getType()->getPointerElementType(), data, values[1], "subslice_data");
+			length = builder.CreateSub(values[2], values[1], "subslice_length");
+		}
+
+		return createSlice(data, length, call, builder, module);
+	}
+
+	// Restrict slices of one function never overlap each other, LLVM learns this
+	// through one alias scope per slice instead of checking it at runtime
+	void declareRestrictScopes(const std::vector<llvm::Value*>& slices, llvm::IRBuilder<>& builder, llvm::Module* module)
+	{
+		if(slices.empty())
+			return;
+
+		llvm::MDBuilder metadata(context);
+		llvm::Function* function = builder.GetInsertBlock()->getParent();
+		llvm::MDNode* domain = metadata.createAnonymousAliasScopeDomain(function->getName());
+
+		std::vector<llvm::Metadata*> scopes;
+		for(auto* slice : slices)
+			scopes.push_back(metadata.createAnonymousAliasScope(domain, slice->getName()));
+
+		for(size_t i = 0; i < slices.size(); i++)
+		{
+			std::vector<llvm::Metadata*> others;
+			for(size_t j = 0; j < scopes.size(); j++)
+				if(j != i)
+					others.push_back(scopes[j]);
+
+			llvm::MDNode* own = llvm::MDNode::get(context, scopes[i]);
+			RestrictScopes[slices[i]] = {own, (others.empty() ? nullptr : llvm::MDNode::get(context, others))};
+			builder.CreateCall(llvm::Intrinsic::getDeclaration(module, llvm::Intrinsic::experimental_noalias_scope_decl),
+				{llvm::MetadataAsValue::get(context, own)});
+		}
+	}
+
+	void annotateRestrict(llvm::Instruction* access, llvm::Value* slice)
+	{
+		auto restrict = RestrictScopes.find(slice);
+		if(restrict == RestrictScopes.end())
+			return;
+
+		access->setMetadata(llvm::LLVMContext::MD_alias_scope, restrict->second.first);
+		if(restrict->second.second)
+			access->setMetadata(llvm::LLVMContext::MD_noalias, restrict->second.second);
+	}
+
+	// Scalars of different types never alias, bytes alias everything like char does in C
+	llvm::MDNode* getTbaaType(llvm::Type* type, llvm::Module* module)
+	{
+		llvm::MDBuilder metadata(context);
+		if(!TbaaRoot)
+		{
+			TbaaRoot = metadata.createTBAARoot("lpp TBAA");
+			TbaaTypes[llvm::Type::getInt8Ty(context)] = metadata.createTBAAScalarTypeNode("omnipotent byte", TbaaRoot);
+		}
+
+		while(type->isArrayTy())
+			type = type->getArrayElementType();
+
+		if(type->isPointerTy())
+			type = llvm::Type::getInt8PtrTy(context);
+
+		auto known = TbaaTypes.find(type);
+		if(known != TbaaTypes.end())
+			return known->second;
+
+		llvm::MDNode* node = nullptr;
+		if(auto* structType = llvm::dyn_cast<llvm::StructType>(type))
+		{
+			if(structType->isOpaque())
+				return nullptr;
+
+			const llvm::StructLayout* layout = module->getDataLayout().getStructLayout(structType);
+			std::vector<std::pair<llvm::MDNode*, uint64_t>> fields;
+			for(unsigned int i = 0; i < structType->getNumElements(); i++)
+			{
+				llvm::MDNode* field = getTbaaType(structType->getElementType(i), module);
+				if(!field)
+					return nullptr;
+				fields.emplace_back(field, layout->getElementOffset(i));
+			}
+
+			node = metadata.createTBAAStructTypeNode(type2str(structType), fields);
+		}
+		else if(type->isIntegerTy() || type->isFloatingPointTy() || type->isPointerTy())
+		{
+			std::string name = type2str(type);
+			if(name == "unknown")
+			{
+				llvm::raw_string_ostream out(name);
+				name.clear();
+				type->print(out);
+				out.flush();
+			}
+
+			node = metadata.createTBAAScalarTypeNode(name, TbaaTypes[llvm::Type::getInt8Ty(context)]);
+		}
+
+		TbaaTypes[type] = node;
+		return node;
+	}
+
+	// Tags scalar loads and stores, base is the class holding the field at offset or null
+	void annotateTbaa(llvm::Instruction* access, llvm::StructType* base, uint64_t offset, llvm::Module* module)
+	{
+		llvm::Type* type = access->getType();
+		if(auto* store = llvm::dyn_cast<llvm::StoreInst>(access))
+			type = store->getValueOperand()->getType();
+
+		if(!type->isIntegerTy() && !type->isFloatingPointTy() && !type->isPointerTy())
+			return;
+
+		llvm::MDNode* scalar = getTbaaType(type, module);
+		llvm::MDNode* structure = (base ? getTbaaType(base, module) : nullptr);
+		if(!scalar)
+			return;
+
+		llvm::MDBuilder metadata(context);
+		if(structure)
+			access->setMetadata(llvm::LLVMContext::MD_tbaa, metadata.createTBAAStructTagNode(structure, scalar, offset));
+		else
+			access->setMetadata(llvm::LLVMContext::MD_tbaa, metadata.createTBAAStructTagNode(scalar, scalar, 0));
+	}
+
+	// Counts from 0 to the length of the range, which is evaluated once
+	llvm::Value* generateRangeFor(RangeFor* fory, LocalScope& scope, llvm::IRBuilder<>& builder, llvm::Module* module)
+	{
+		llvm::Value* value = generateIr(fory->getRange(), scope, builder, module);
+		if(!value)
+			return nullptr;
+
+		llvm::Value* data = nullptr;
+		llvm::Value* length = nullptr;
+		llvm::Value* restrict = nullptr;
+		if(!getRange(value, data, length, &restrict, builder))
+		{
+			error("only slices and arrays can be iterated", fory->getRange()->getLocation());
+			return nullptr;
+		}
+
+		std::string indexName = (fory->getIndex().empty() ? fory->getValue() + "_index" : fory->getIndex());
+		for(auto& name : {indexName, fory->getValue()})
+			if(scope.current().find(name) != scope.current().end())
+			{
+				error("variable name collision", fory->getLocation());
+				return nullptr;
+			}
+
+		llvm::Type* elementType = data->getType()->getPointerElementType();
+		llvm::AllocaInst* index = createLocal(builder, builder.getInt32Ty(), indexName);
+		llvm::AllocaInst* element = createLocal(builder, elementType, fory->getValue());
+		scope.current()[indexName] = index;
+		scope.current()[fory->getValue()] = element;
+		builder.CreateStore(builder.getInt32(0), index);
+
+		llvm::Function* function = builder.GetInsertBlock()->getParent();
+		llvm::BasicBlock* for_cond = llvm::BasicBlock::Create(context, "range_cond", function);
+		llvm::BasicBlock* for_true = llvm::BasicBlock::Create(context, "range_true", function);
+		llvm::BasicBlock* for_continue = llvm::BasicBlock::Create(context, "range_continue", function);
+
+		builder.CreateBr(for_cond);
+		builder.SetInsertPoint(for_cond);
+		llvm::Value* i = builder.CreateLoad(builder.getInt32Ty(), index, "range_i");
+		auto branch = builder.CreateCondBr(builder.CreateICmpSLT(i, length, "range_check"), for_true, for_continue);
+
+		builder.SetInsertPoint(for_true);
+		auto load = builder.CreateLoad(elementType, builder.CreateInBoundsGEP(elementType, data, i, "range_gep"), "range_element");
+		annotateRestrict(load, restrict);
+		builder.CreateStore(load, element);
+
+		generateIr(fory->getBody(), scope, builder, module);
+
+		i = builder.CreateLoad(builder.getInt32Ty(), index, "range_i");
+		builder.CreateStore(builder.CreateNSWAdd(i, builder.getInt32(1), "range_next"), index);
+		// The loop ends because the counter only grows up to length
+		setLoopMetadata(builder.CreateBr(for_cond), fory, true);
+
+		builder.SetInsertPoint(for_continue);
+		return branch;
+	}
+
+	// Loop attributes become hints on the backedge. Forced transformations that LLVM
+	// can not perform are reported as warnings by opt.
+	void setLoopMetadata(llvm::BranchInst* backedge, Expr* loop, bool mustProgress)
+	{
+		auto hint = [this](const std::string& name, llvm::Metadata* value = nullptr) -> llvm::Metadata* {
+			std::vector<llvm::Metadata*> operands = {llvm::MDString::get(context, name)};
+			if(value)
+				operands.push_back(value);
+			return llvm::MDNode::get(context, operands);
+		};
+
+		auto count = [this](int value) { return llvm::ConstantAsMetadata::get(llvm::ConstantInt::get(llvm::Type::getInt32Ty(context), value)); };
+		auto flag = [this](bool value) { return llvm::ConstantAsMetadata::get(llvm::ConstantInt::get(llvm::Type::getInt1Ty(context), value)); };
+
+		llvm::TempMDTuple placeholder = llvm::MDNode::getTemporary(context, {});
+		std::vector<llvm::Metadata*> operands = {placeholder.get()};
+		if(mustProgress)
+			operands.push_back(hint("llvm.loop.mustprogress"));
+
+		for(auto& attribute : loop->getAttributes())
+		{
+			std::string name = attribute.substr(0, attribute.find('('));
+			// Counts that are no number or do not fit into an int end up as 0 and are reported
+			int value = 0;
+			if(name.size() != attribute.size())
+			{
+				const char* begin = attribute.c_str() + name.size() + 1;
+				char* end = nullptr;
+				errno = 0;
+				long long parsed = std::strtoll(begin, &end, 10);
+				if(end != begin && *end == ')' && errno == 0 && parsed <= INT_MAX)
+					value = static_cast<int>(parsed);
+			}
+
+			if(name.size() != attribute.size() && value <= 0)
+				error("loop attribute '" + name + "' needs a positive count", loop->getLocation());
+			else if(name == "unroll" && value)
+				operands.push_back(hint("llvm.loop.unroll.count", count(value)));
+			else if(attribute == "unroll")
+				operands.push_back(hint("llvm.loop.unroll.enable"));
+			else if(attribute == "nounroll")
+				operands.push_back(hint("llvm.loop.unroll.disable"));
+			else if(name == "vectorize")
+			{
+				if(value)
+					operands.push_back(hint("llvm.loop.vectorize.width", count(value)));
+				operands.push_back(hint("llvm.loop.vectorize.enable", flag(true)));
+			}
+			else if(attribute == "novectorize")
+				operands.push_back(hint("llvm.loop.vectorize.width", count(1)));
+			else if(name == "interleave" && value)
+				operands.push_back(hint("llvm.loop.interleave.count", count(value)));
+			else
+			{
+				error("unknown loop attribute '" + attribute + "'", loop->getLocation());
+				continue;
+			}
+		}
+
+		if(loop->hasAttribute("novectorize") && (loop->hasAttribute("vectorize") || hasCountedAttribute(loop, "vectorize")))
+			error("loop can not be both 'vectorize' and 'novectorize'", loop->getLocation());
+
+		if(loop->hasAttribute("nounroll") && (loop->hasAttribute("unroll") || hasCountedAttribute(loop, "unroll")))
+			error("loop can not be both 'unroll' and 'nounroll'", loop->getLocation());
+
+		if(operands.size() == 1)
+			return;
+
+		llvm::MDNode* node = llvm::MDNode::get(context, operands);
+		node->replaceOperandWith(0, node);
+		backedge->setMetadata(llvm::LLVMContext::MD_loop, node);
+	}
+
+	static bool hasCountedAttribute(Expr* expr, const std::string& name)
+	{
+		for(auto& attribute : expr->getAttributes())
+			if(attribute.compare(0, name.size() + 1, name + "(") == 0)
+				return true;
+		return false;
+	}
+
+	// Async functions use the switched-resume lowering of the llvm.coro intrinsics. Their frame is
+	// allocated with malloc unless LLVM can prove it does not outlive the caller and elides it.
+	void beginCoroutine(Coroutine& coroutine, llvm::Type* result, llvm::IRBuilder<>& builder, llvm::Module* module)
+	{
+		UsesCoroutines = true;
+		llvm::Function* function = builder.GetInsertBlock()->getParent();
+		llvm::Value* null = llvm::ConstantPointerNull::get(builder.getInt8PtrTy());
+		llvm::Value* promise = null;
+
+		if(!result->isVoidTy())
+		{
+			coroutine.Promise = createLocal(builder, result, "promise");
+			coroutine.Promise->setAlignment(module->getDataLayout().getABITypeAlign(result));
+			promise = builder.CreateBitCast(coroutine.Promise, builder.getInt8PtrTy(), "promise_ptr");
+		}
+
+		coroutine.Id = builder.CreateCall(llvm::Intrinsic::getDeclaration(module, llvm::Intrinsic::coro_id),
+										  {builder.getInt32(0), promise, null, null}, "coro_id");
+
+		llvm::BasicBlock* coro_entry = builder.GetInsertBlock();
+		llvm::BasicBlock* coro_alloc = llvm::BasicBlock::Create(context, "coro_alloc", function);
+		llvm::BasicBlock* coro_begin = llvm::BasicBlock::Create(context, "coro_begin", function);
+
+		llvm::Value* needed = builder.CreateCall(llvm::Intrinsic::getDeclaration(module, llvm::Intrinsic::coro_alloc), {coroutine.Id}, "coro_needs_memory");
+		builder.CreateCondBr(needed, coro_alloc, coro_begin);
+
+		builder.SetInsertPoint(coro_alloc);
+		llvm::Value* size = builder.CreateCall(llvm::Intrinsic::getDeclaration(module, llvm::Intrinsic::coro_size, {builder.getInt64Ty()}), {}, "coro_size");
+		llvm::FunctionCallee malloc = module->getOrInsertFunction("malloc", builder.getInt8PtrTy(), builder.getInt64Ty());
+		llvm::Value* memory = builder.CreateCall(malloc, {size}, "coro_memory");
+		builder.CreateBr(coro_begin);
+
+		builder.SetInsertPoint(coro_begin);
+		llvm::PHINode* frame = builder.CreatePHI(builder.getInt8PtrTy(), 2, "coro_frame");
+		frame->addIncoming(null, coro_entry);
+		frame->addIncoming(memory, coro_alloc);
+		coroutine.Handle = builder.CreateCall(llvm::Intrinsic::getDeclaration(module, llvm::Intrinsic::coro_begin), {coroutine.Id, frame}, "coro_handle");
+
+		// Inserted into the function by endCoroutine so they come last
+		coroutine.Final = llvm::BasicBlock::Create(context, "coro_final");
+		coroutine.Cleanup = llvm::BasicBlock::Create(context, "coro_cleanup");
+		coroutine.Suspend = llvm::BasicBlock::Create(context, "coro_suspend");
+
+		// Calls only create the coroutine, the first resume runs it
+		generateSuspend(coroutine, builder, module);
+	}
+
+	// Continues in a new block once the coroutine is resumed
+	void generateSuspend(Coroutine& coroutine, llvm::IRBuilder<>& builder, llvm::Module* module)
+	{
+		llvm::Function* function = builder.GetInsertBlock()->getParent();
+		llvm::BasicBlock* coro_resume = llvm::BasicBlock::Create(context, "coro_resume", function);
+
+		llvm::Value* state = builder.CreateCall(llvm::Intrinsic::getDeclaration(module, llvm::Intrinsic::coro_suspend),
+												{llvm::ConstantTokenNone::get(context), builder.getFalse()}, "coro_state");
+		llvm::SwitchInst* next = builder.CreateSwitch(state, coroutine.Suspend, 2);
+		next->addCase(builder.getInt8(0), coro_resume);
+		next->addCase(builder.getInt8(1), coroutine.Cleanup);
+
+		builder.SetInsertPoint(coro_resume);
+	}
+
+	void endCoroutine(Coroutine& coroutine, llvm::IRBuilder<>& builder, llvm::Module* module)
+	{
+		llvm::Function* function = builder.GetInsertBlock()->getParent();
+		builder.CreateBr(coroutine.Final);
+
+		// Finished coroutines stay suspended until they are destroyed so their result can be read
+		coroutine.Final->insertInto(function);
+		builder.SetInsertPoint(coroutine.Final);
+		llvm::Value* state = builder.CreateCall(llvm::Intrinsic::getDeclaration(module, llvm::Intrinsic::coro_suspend),
+												{llvm::ConstantTokenNone::get(context), builder.getTrue()}, "coro_final_state");
+		builder.CreateSwitch(state, coroutine.Suspend, 1)->addCase(builder.getInt8(1), coroutine.Cleanup);
+
+		coroutine.Cleanup->insertInto(function);
+		builder.SetInsertPoint(coroutine.Cleanup);
+		llvm::Value* memory = builder.CreateCall(llvm::Intrinsic::getDeclaration(module, llvm::Intrinsic::coro_free), {coroutine.Id, coroutine.Handle}, "coro_free_memory");
+		llvm::BasicBlock* coro_release = llvm::BasicBlock::Create(context, "coro_release", function);
+		builder.CreateCondBr(builder.CreateIsNotNull(memory, "coro_allocated"), coro_release, coroutine.Suspend);
+
+		builder.SetInsertPoint(coro_release);
+		llvm::FunctionCallee free = module->getOrInsertFunction("free", builder.getVoidTy(), builder.getInt8PtrTy());
+		builder.CreateCall(free, {memory});
+		builder.CreateBr(coroutine.Suspend);
+
+		coroutine.Suspend->insertInto(function);
+		builder.SetInsertPoint(coroutine.Suspend);
+		builder.CreateCall(llvm::Intrinsic::getDeclaration(module, llvm::Intrinsic::coro_end), {coroutine.Handle, builder.getFalse()});
+		builder.CreateRet(coroutine.Handle);
+	}
+
+	// 'yield value' stores the value and suspends, 'return value' stores it and finishes
+	llvm::Value* generateYield(std::shared_ptr<Expr>& value, Expr* where, LocalScope& scope, llvm::IRBuilder<>& builder, llvm::Module* module)
+	{
+		if(!CurrentCoroutine)
+		{
+			error("yield can only be used in async functions", where->getLocation());
+			return nullptr;
+		}
+
+		Coroutine& coroutine = *CurrentCoroutine;
+		if(value)
+		{
+			llvm::Value* result = generateIr(value, scope, builder, module);
+			if(!result)
+				return nullptr;
+
+			result = var2val(builder, result);
+			if(!coroutine.Promise || result->getType() != coroutine.Promise->getAllocatedType())
+			{
+				error("async function can not produce a result of type '" + type2str(result->getType()) + "'", where->getLocation());
+				return nullptr;
+			}
+			builder.CreateStore(result, coroutine.Promise);
+		}
+
+		if(dynamic_cast<Return*>(where))
+			return builder.CreateBr(coroutine.Final);
+
+		generateSuspend(coroutine, builder, module);
+		return coroutine.Handle;
+	}
+
+	llvm::Value* generateAwait(Await* await, LocalScope& scope, llvm::IRBuilder<>& builder, llvm::Module* module)
+	{
+		if(!CurrentCoroutine)
+		{
+			error("await can only be used in async functions", await->getLocation());
+			return nullptr;
+		}
+
+		auto call = llvm::dyn_cast_or_null<llvm::CallInst>(generateIr(await->getValue(), scope, builder, module));
+		auto iter = (call && call->getCalledFunction() ? AsyncFunctions.find(call->getCalledFunction()->getName().str()) : AsyncFunctions.end());
+		if(iter == AsyncFunctions.end())
+		{
+			error("await expects a call of an async function", await->getLocation());
+			return nullptr;
+		}
+
+		UsesCoroutines = true;
+		llvm::Function* function = builder.GetInsertBlock()->getParent();
+		llvm::BasicBlock* await_resume = llvm::BasicBlock::Create(context, "await_resume", function);
+		llvm::BasicBlock* await_suspend = llvm::BasicBlock::Create(context, "await_suspend", function);
+		llvm::BasicBlock* await_done = llvm::BasicBlock::Create(context, "await_done", function);
+
+		// The awaited coroutine runs as part of this one, whenever it suspends this one suspends too
+		builder.CreateBr(await_resume);
+		builder.SetInsertPoint(await_resume);
+		builder.CreateCall(llvm::Intrinsic::getDeclaration(module, llvm::Intrinsic::coro_resume), {call});
+		llvm::Value* done = builder.CreateCall(llvm::Intrinsic::getDeclaration(module, llvm::Intrinsic::coro_done), {call}, "await_finished");
+		builder.CreateCondBr(done, await_done, await_suspend);
+
+		builder.SetInsertPoint(await_suspend);
+		generateSuspend(*CurrentCoroutine, builder, module);
+		builder.CreateBr(await_resume);
+
+		builder.SetInsertPoint(await_done);
+		llvm::Value* result = nullptr;
+		llvm::Type* type = getType(builder, iter->second, module);
+		if(!type->isVoidTy())
+			result = builder.CreateLoad(type, generatePromise(call, type, builder, module), "await_result");
+
+		llvm::Value* destroy = builder.CreateCall(llvm::Intrinsic::getDeclaration(module, llvm::Intrinsic::coro_destroy), {call});
+		return (result ? result : destroy);
+	}
+
+	llvm::Value* generatePromise(llvm::Value* handle, llvm::Type* type, llvm::IRBuilder<>& builder, llvm::Module* module)
+	{
+		llvm::Value* align = builder.getInt32(module->getDataLayout().getABITypeAlign(type).value());
+		llvm::Value* promise = builder.CreateCall(llvm::Intrinsic::getDeclaration(module, llvm::Intrinsic::coro_promise),
+												  {handle, align, builder.getFalse()}, "promise_ptr");
+		return builder.CreateBitCast(promise, type->getPointerTo(), "promise");
+	}
+
+	// coroutine_resume(h), coroutine_done(h), coroutine_destroy(h), coroutine_value(h, Type) and coroutine_self()
+	llvm::Value* generateCoroutineBuiltin(FunctionCall* call, LocalScope& scope, llvm::IRBuilder<>& builder, llvm::Module* module)
+	{
+		const std::string name = call->getName();
+		auto& args = call->getArgs();
+		UsesCoroutines = true;
+
+		if(name == "coroutine_self")
+		{
+			if(!CurrentCoroutine)
+			{
+				error("coroutine_self can only be used in async functions", call->getLocation());
+				return nullptr;
+			}
+			return CurrentCoroutine->Handle;
+		}
+
+		const size_t count = (name == "coroutine_value" ? 2 : 1);
+		if(args.size() != count)
+		{
+			error("'" + name + "' expects " + std::to_string(count) + " arguments", call->getLocation());
+			return nullptr;
+		}
+
+		llvm::Value* handle = generateIr(args[0], scope, builder, module);
+		if(!handle)
+			return nullptr;
+
+		handle = var2val(builder, handle);
+		if(handle->getType() != builder.getInt8PtrTy())
+		{
+			error("'" + name + "' expects a coroutine handle of type '@void'", args[0]->getLocation());
+			return nullptr;
+		}
+
+		if(name == "coroutine_resume")
+			return builder.CreateCall(llvm::Intrinsic::getDeclaration(module, llvm::Intrinsic::coro_resume), {handle});
+		else if(name == "coroutine_destroy")
+			return builder.CreateCall(llvm::Intrinsic::getDeclaration(module, llvm::Intrinsic::coro_destroy), {handle});
+		else if(name == "coroutine_done")
+			return builder.CreateCall(llvm::Intrinsic::getDeclaration(module, llvm::Intrinsic::coro_done), {handle}, "coroutine_done");
+
+		// The type has to match the result type of the async function
+		auto typeName = dynamic_cast<Variable*>(args[1].get());
+		llvm::Type* type = (typeName ? getType(builder, typeName->getName(), module) : nullptr);
+		if(!type || type->isVoidTy())
+		{
+			error("coroutine_value expects the result type of the coroutine", args[1]->getLocation());
+			return nullptr;
+		}
+
+		return builder.CreateLoad(generatePromise(handle, type, builder, module), "coroutine_value");
+	}
+
+	void eraseDeadLoad(llvm::LoadInst* load)
+	{
+		// Atomic loads are never removed by the optimizer
+		if(load->use_empty())
+			load->eraseFromParent();
+	}
+
+	bool checkAtomicType(llvm::Type* type, Expr* where)
+	{
+		if(type && type->isArrayTy())
+			type = type->getArrayElementType();
+
+		if(!type || (type->isIntegerTy() && type->getIntegerBitWidth() < 8)
+			|| !(type->isIntegerTy() || type->isFloatingPointTy() || type->isPointerTy()))
+		{
+			error("atomic variables need an integer, float or pointer type", where->getLocation());
+			return false;
+		}
+		return true;
+	}
+
+	bool getOrdering(const std::shared_ptr<Expr>& expr, llvm::AtomicOrdering& ordering)
+	{
+		static const std::unordered_map<std::string, llvm::AtomicOrdering> orderings = {
+			{"relaxed", llvm::AtomicOrdering::Monotonic},
+			{"acquire", llvm::AtomicOrdering::Acquire},
+			{"release", llvm::AtomicOrdering::Release},
+			{"acq_rel", llvm::AtomicOrdering::AcquireRelease},
+			{"seq_cst", llvm::AtomicOrdering::SequentiallyConsistent}
+		};
+
+		auto str = dynamic_cast<String*>(expr.get());
+		auto iter = (str ? orderings.find(str->getValue()) : orderings.end());
+		if(iter == orderings.end())
+		{
+			error("memory order has to be one of \"relaxed\", \"acquire\", \"release\", \"acq_rel\" or \"seq_cst\"", expr->getLocation());
+			return false;
+		}
+
+		ordering = iter->second;
+		return true;
+	}
+
+	// atomic_*(variable, operands..., orders...) work on the variable itself, not its value
+	llvm::Value* generateAtomic(FunctionCall* call, LocalScope& scope, llvm::IRBuilder<>& builder, llvm::Module* module)
+	{
+		static const std::unordered_map<std::string, llvm::AtomicRMWInst::BinOp> operations = {
+			{"atomic_exchange", llvm::AtomicRMWInst::Xchg},
+			{"atomic_fetch_add", llvm::AtomicRMWInst::Add},
+			{"atomic_fetch_sub", llvm::AtomicRMWInst::Sub},
+			{"atomic_fetch_and", llvm::AtomicRMWInst::And},
+			{"atomic_fetch_or", llvm::AtomicRMWInst::Or},
+			{"atomic_fetch_xor", llvm::AtomicRMWInst::Xor}
+		};
+
+		const std::string name = call->getName();
+		auto& args = call->getArgs();
+
+		const size_t operands = (name == "atomic_fence" ? 0 : name == "atomic_load" ? 1 : name == "atomic_compare_exchange" ? 3 : 2);
+		const size_t orders = (name == "atomic_compare_exchange" ? 2 : 1);
+		if(args.size() < operands || args.size() > operands + orders)
+		{
+			error("'" + name + "' expects " + std::to_string(operands) + " arguments and up to "
+				  + std::to_string(orders) + " memory orders", call->getLocation());
+			return nullptr;
+		}
+
+		auto ordering = llvm::AtomicOrdering::SequentiallyConsistent;
+		if(args.size() > operands && !getOrdering(args[operands], ordering))
+			return nullptr;
+
+		if(name == "atomic_fence")
+		{
+			if(ordering == llvm::AtomicOrdering::Monotonic)
+			{
+				error("fences can not be relaxed", call->getLocation());
+				return nullptr;
+			}
+			return builder.CreateFence(ordering);
+		}
+
+		auto* load = llvm::dyn_cast_or_null<llvm::LoadInst>(generateIr(args[0], scope, builder, module));
+		if(!load)
+		{
+			error("'" + name + "' expects a variable", args[0]->getLocation());
+			return nullptr;
+		}
+
+		llvm::Value* address = load->getPointerOperand();
+		llvm::Type* type = load->getType();
+		eraseDeadLoad(load);
+
+		if(!checkAtomicType(type, args[0].get()))
+			return nullptr;
+
+		std::vector<llvm::Value*> values;
+		for(size_t i = 1; i < operands; i++)
+		{
+			llvm::Value* value = generateIr(args[i], scope, builder, module);
+			if(!value)
+				return nullptr;
+
+			if(value->getType() != type)
+			{
+				error("'" + name + "' expected '" + type2str(type) + "' but got '" + type2str(value->getType()) + "'", args[i]->getLocation());
+				return nullptr;
+			}
+			values.push_back(value);
+		}
+
+		if(name == "atomic_load")
+		{
+			if(ordering == llvm::AtomicOrdering::Release || ordering == llvm::AtomicOrdering::AcquireRelease)
+			{
+				error("atomic loads can not release", call->getLocation());
+				return nullptr;
+			}
+
+			auto* result = builder.CreateLoad(type, address, "atomic_load");
+			result->setAtomic(ordering);
+			return result;
+		}
+
+		if(name == "atomic_store")
+		{
+			if(ordering == llvm::AtomicOrdering::Acquire || ordering == llvm::AtomicOrdering::AcquireRelease)
+			{
+				error("atomic stores can not acquire", call->getLocation());
+				return nullptr;
+			}
+
+			auto* result = builder.CreateStore(values[0], address);
+			result->setAtomic(ordering);
+			return result;
+		}
+
+		if(name == "atomic_compare_exchange")
+		{
+			if(type->isFloatingPointTy())
+			{
+				error("'" + name + "' needs an integer or pointer type", call->getLocation());
+				return nullptr;
+			}
+
+			auto failure = llvm::AtomicCmpXchgInst::getStrongestFailureOrdering(ordering);
+			if(args.size() > 4 && !getOrdering(args[4], failure))
+				return nullptr;
+
+			if(failure == llvm::AtomicOrdering::Release || failure == llvm::AtomicOrdering::AcquireRelease)
+			{
+				error("the failure order can not release", args[4]->getLocation());
+				return nullptr;
+			}
+
+			auto* pair = builder.CreateAtomicCmpXchg(address, values[0], values[1], llvm::MaybeAlign(), ordering, failure);
+
+			// Like in C the value seen is written back to expected, which makes retry loops simple
+			if(auto* expected = llvm::dyn_cast<llvm::LoadInst>(values[0]))
+				builder.CreateStore(builder.CreateExtractValue(pair, 0, "cmpxchg_seen"), expected->getPointerOperand());
+
+			return builder.CreateExtractValue(pair, 1, "cmpxchg_success");
+		}
+
+		auto operation = operations.at(name);
+		if(type->isFloatingPointTy())
+		{
+			if(operation == llvm::AtomicRMWInst::Add)
+				operation = llvm::AtomicRMWInst::FAdd;
+			else if(operation == llvm::AtomicRMWInst::Sub)
+				operation = llvm::AtomicRMWInst::FSub;
+			else if(operation != llvm::AtomicRMWInst::Xchg)
+			{
+				error("'" + name + "' needs an integer type", call->getLocation());
+				return nullptr;
+			}
+		}
+		else if(type->isPointerTy())
+		{
+			if(operation != llvm::AtomicRMWInst::Xchg)
+			{
+				error("'" + name + "' needs an integer type", call->getLocation());
+				return nullptr;
+			}
+
+			// Exchanging pointers goes through integers of the same size
+			llvm::Type* intType = module->getDataLayout().getIntPtrType(context);
+			llvm::Value* intAddress = builder.CreatePointerCast(address, intType->getPointerTo(), "atomic_address");
+			llvm::Value* intValue = builder.CreatePtrToInt(values[0], intType, "atomic_value");
+			llvm::Value* old = builder.CreateAtomicRMW(operation, intAddress, intValue, llvm::MaybeAlign(), ordering);
+			return builder.CreateIntToPtr(old, type, "atomic_old");
+		}
+
+		return builder.CreateAtomicRMW(operation, address, values[0], llvm::MaybeAlign(), ordering);
+	}
+
+	// sizeof(Name) takes a type name, the size is left to the target data layout
+	llvm::Value* generateSizeof(FunctionCall* call, llvm::IRBuilder<>& builder, llvm::Module* module)
+	{
+		Variable* name = nullptr;
+		if(call->getArgs().size() != 1
+			|| !(name = dynamic_cast<Variable*>(call->getArgs()[0].get()))
+			|| name->getField() || name->getIndex())
+		{
+			error("sizeof expects a type name", call->getLocation());
+			return nullptr;
+		}
+
+		llvm::Type* type = getType(builder, name->getName(), module);
+		if(!type || type->isVoidTy())
+		{
+			error("unknown type '" + name->getName() + "'", name->getLocation());
+			return nullptr;
+		}
+
+		return llvm::ConstantExpr::getTruncOrBitCast(llvm::ConstantExpr::getSizeOf(type), builder.getInt32Ty());
+	}
+
+	// new(Class, allocator, args...) takes memory from allocator:allocate(size) or malloc
+	// and runs the constructor, a method named like the class, with the remaining arguments
+	llvm::Value* generateNew(FunctionCall* call, LocalScope& scope, llvm::IRBuilder<>& builder, llvm::Module* module)
+	{
+		auto& args = call->getArgs();
+		Variable* name = (args.empty() ? nullptr : dynamic_cast<Variable*>(args[0].get()));
+		if(!name || name->getField() || name->getIndex())
+		{
+			error("new expects a class name", call->getLocation());
+			return nullptr;
+		}
+
+		if(scope.Classes.find(name->getName()) == scope.Classes.end())
+		{
+			error("class '" + name->getName() + "' is undefined", name->getLocation());
+			return nullptr;
+		}
+
+		auto size = std::make_shared<FunctionCall>("sizeof");
+		size->getArgs().push_back(args[0]);
+
+		std::shared_ptr<FunctionCall> allocation;
+		if(args.size() > 1)
+		{
+			allocation = std::make_shared<FunctionCall>("allocate", true);
+			allocation->getArgs().push_back(args[1]);
+			allocation->getArgs().push_back(size);
+		}
+		else
+		{
+			allocation = std::make_shared<FunctionCall>("malloc");
+			allocation->getArgs().push_back(std::make_shared<TypeCast>("int64", size));
+		}
+
+		allocation->setLocation(call->getLocation());
+		llvm::Value* memory = generateIr(allocation, scope, builder, module);
+		if(!memory)
+			return nullptr;
+
+		if(!memory->getType()->isPointerTy())
+		{
+			error("allocate has to return a pointer but returns '" + type2str(memory->getType()) + "'", call->getLocation());
+			return nullptr;
+		}
+
+		llvm::Type* type = getType(builder, name->getName(), module);
+		llvm::Value* object = builder.CreatePointerCast(memory, type->getPointerTo(), "new_object");
+
+		llvm::Function* constructor = module->getFunction(name->getName() + "_" + name->getName());
+		if(!constructor)
+		{
+			if(args.size() > 2)
+				error("class '" + name->getName() + "' has no constructor", call->getLocation());
+			return object;
+		}
+
+		std::vector<llvm::Value*> constructorArgs = { object };
+		for(size_t i = 2; i < args.size(); i++)
+		{
+			llvm::Value* value = generateIr(args[i], scope, builder, module);
+			if(!value)
+				return nullptr;
+			constructorArgs.push_back(value);
+		}
+
+		llvm::FunctionType* constructorType = getSourceType(constructor);
+		if(constructorType->getNumParams() != constructorArgs.size())
+		{
+			error("argument count mismatch, required " + std::to_string(constructorType->getNumParams() - 1)
+				  + " but given " + std::to_string(constructorArgs.size() - 1), call->getLocation());
+			return nullptr;
+		}
+
+		for(size_t i = 1; i < constructorArgs.size(); i++)
+			if(constructorArgs[i]->getType() != constructorType->getParamType(i))
+			{
+				error("argument type mismatch, expected '" + type2str(constructorType->getParamType(i))
+					  + "' but got '" + type2str(constructorArgs[i]->getType()) + "'", args[i + 1]->getLocation());
+				return nullptr;
+			}
+
+		createCall(constructor, constructorArgs, builder, module);
+		return object;
+	}
+
+	llvm::Function* instantiateFunction(Function* function, FunctionCall* call, const std::vector<llvm::Value*>& args,
+										LocalScope& scope, llvm::IRBuilder<>& builder, llvm::Module* module)
+	{
+		std::vector<std::string> argTypes;
+		for(auto* v : args)
+			argTypes.push_back(type2str(v->getType()));
+
+		auto instance = Generics.instantiateFunction(function, argTypes, call);
+		if(!instance)
+			return nullptr;
+
+		if(llvm::Function* existing = module->getFunction(instance->getName()))
+			return existing;
+
+		std::vector<std::shared_ptr<ClassDef>> classes;
+		Generics.instantiateClasses(instance.get(), classes);
+
+		// The instance is generated out of line and must not see the locals of the caller
+		auto insertPoint = builder.saveIP();
+		LocalScope instanceScope;
+		instanceScope.Classes = scope.Classes;
+
+		for(auto& c : classes)
+			generateIr(c, instanceScope, builder, module);
+
+		auto* llvmFunction = llvm::cast_or_null<llvm::Function>(generateIr(instance, instanceScope, builder, module));
+
+		scope.Classes = instanceScope.Classes;
+		builder.restoreIP(insertPoint);
+		return llvmFunction;
+	}
+	
+	// Struct layouts and calls have to agree with the C code the result is linked with
+	void setTarget(llvm::Module* module)
+	{
+		std::string triple = llvm::sys::getDefaultTargetTriple();
+		module->setTargetTriple(triple);
+
+		llvm::InitializeNativeTarget();
+		std::string message;
+		const llvm::Target* target = llvm::TargetRegistry::lookupTarget(triple, message);
+		if(!target)
+		{
+			std::cerr << "Warning: " << message << std::endl;
+			return;
+		}
+
+		TargetCpu = Flags.targetCpu;
+		TargetFeatures.clear();
+		if(TargetCpu == "native")
+		{
+			TargetCpu = llvm::sys::getHostCPUName().str();
+
+			llvm::StringMap<bool> features;
+			if(llvm::sys::getHostCPUFeatures(features))
+				for(auto& feature : features)
+					TargetFeatures += (TargetFeatures.empty() ? "" : ",") + std::string(feature.second ? "+" : "-") + feature.first().str();
+		}
+
+		if(!Flags.targetFeatures.empty())
+			TargetFeatures += (TargetFeatures.empty() ? "" : ",") + Flags.targetFeatures;
+
+		std::unique_ptr<llvm::TargetMachine> machine(target->createTargetMachine(triple, TargetCpu, TargetFeatures, {}, llvm::None));
+		if(!machine)
+		{
+			std::cerr << "Warning: can not generate code for CPU '" << TargetCpu << "'" << std::endl;
+			return;
+		}
+
+		module->setDataLayout(machine->createDataLayout());
+	}
+
+	std::unique_ptr<llvm::Module> generateLlvm(const std::string& name)
+	{
+		// Get a list of required librarie and
+		// llvm::Linker::link them.
+		preprocess();
+
+		// Meta blocks and constant folding leave a lot of dead code behind
+		Simplifier simplifier;
+		simplifier.simplify(*this);
+		// dump();
+
+		auto module = std::make_unique<llvm::Module>(name, context);
+		setTarget(module.get());
+		llvm::IRBuilder<> builder(context); 
+		
+		LocalScope scope;
+		generateIr(TopLevel, scope, builder, module.get());
+
+		// The JIT compiles for the CPU it runs on, one version is enough
+		if(!Flags.run && !Flags.repl)
+			for(auto& multiversioned : Multiversioned)
+				createMultiversion(multiversioned.first, multiversioned.second, module.get());
+		Multiversioned.clear();
+
+		return module;
+	}
+
+	// Compiles the entries added to TopLevel since the last call. Definitions stay,
+	// everything else goes into the function named entry, which is empty when
+	// there is nothing to run. Returns null when the input had errors.
+	std::unique_ptr<llvm::Module> generateIncremental(const std::string& name, std::string& entry)
+	{
+		size_t first = Generated;
+		unsigned int errors = ErrorCount;
+		auto classes = ReplScope.Classes;
+		entry.clear();
+
+		preprocess(first);
+		Simplifier simplifier;
+		simplifier.simplify(*this);
+
+		auto module = std::make_unique<llvm::Module>(name, context);
+		setTarget(module.get());
+		if(!ReplDeclarations)
+			ReplDeclarations = std::make_unique<llvm::Module>("declarations", context);
+		declareDefinitions(*ReplDeclarations, *module);
+
+		// Statements run once and do not stay in the program
+		std::vector<std::shared_ptr<Expr>> statements;
+		std::vector<std::shared_ptr<Expr>> definitions;
+		for(size_t i = first; i < TopLevel.size(); i++)
 		{
-			scope.exit();
-			return llvm::ConstantInt::get(context, llvm::APInt(32, var->getValue(), true));
+			auto& k = TopLevel[i];
+			if(dynamic_cast<Function*>(k.get()) || dynamic_cast<ClassDef*>(k.get())
+				|| dynamic_cast<VariableDef*>(k.get()) || dynamic_cast<Meta*>(k.get()))
+				definitions.push_back(k);
+			else
+				statements.push_back(k);
 		}
-		
-		if(auto var = dynamic_cast<Bool*>(k.get()))
+
+		for(auto& k : definitions)
+			if(auto function = dynamic_cast<Function*>(k.get()))
+				if(!function->getExtern() && !function->isTemplate() && ReplDefined.count(function->getName()))
+					error("function '" + function->getName() + "' is already defined", function->getLocation());
+
+		TopLevel.resize(first);
+		TopLevel.insert(TopLevel.end(), definitions.begin(), definitions.end());
+
+		llvm::IRBuilder<> builder(context);
+		if(ErrorCount == errors)
+			for(auto& k : definitions)
+				generateIr(k, ReplScope, builder, module.get());
+
+		if(ErrorCount == errors && !statements.empty())
 		{
-			scope.exit();
-			return llvm::ConstantInt::get(context, llvm::APInt(1, var->getValue(), true));
+			entry = name + "_entry";
+			generateReplEntry(statements, entry, builder, module.get());
 		}
-		
-		if(auto var = dynamic_cast<Byte*>(k.get()))
+		Multiversioned.clear();
+
+		// Nothing of a broken input stays behind
+		if(ErrorCount != errors)
 		{
-			scope.exit();
-			return llvm::ConstantInt::get(context, llvm::APInt(8, var->getValue(), true));
+			TopLevel.resize(first);
+			ReplScope.Classes = classes;
+			entry.clear();
+			forgetModule(module.get());
+			return nullptr;
 		}
-		
-		if(auto var = dynamic_cast<String*>(k.get()))
+
+		declareDefinitions(*module, *ReplDeclarations);
+		for(auto& function : *module)
+			if(!function.isDeclaration())
+				ReplDefined.insert(function.getName().str());
+
+		// The JIT frees the module once it is compiled
+		forgetModule(module.get());
+		Generated = TopLevel.size();
+		return module;
+	}
+
+	// Drops what the side tables know about the values of a module before it goes away,
+	// new values could get the same addresses later
+	void forgetModule(llvm::Module* module)
+	{
+		auto owner = [](const llvm::Value* value) -> const llvm::Module* {
+			if(auto global = llvm::dyn_cast<llvm::GlobalValue>(value))
+				return global->getParent();
+			if(auto instruction = llvm::dyn_cast<llvm::Instruction>(value))
+				return (instruction->getParent() ? instruction->getModule() : nullptr);
+			if(auto argument = llvm::dyn_cast<llvm::Argument>(value))
+				return argument->getParent()->getParent();
+			return nullptr;
+		};
+
+		for(auto k = SourceTypes.begin(); k != SourceTypes.end();)
+			k = (k->first->getParent() == module ? SourceTypes.erase(k) : std::next(k));
+		for(auto k = AtomicValues.begin(); k != AtomicValues.end();)
+			k = (owner(*k) == module ? AtomicValues.erase(k) : std::next(k));
+		for(auto k = RestrictScopes.begin(); k != RestrictScopes.end();)
+			k = (owner(k->first) == module ? RestrictScopes.erase(k) : std::next(k));
+	}
+
+	// Declares the functions and globals of from that other modules can use in into
+	void declareDefinitions(llvm::Module& from, llvm::Module& into)
+	{
+		for(auto& function : from)
 		{
-			scope.exit();
-			llvm::GlobalVariable* str = builder.CreateGlobalString(var->getValue(), "string");
-			str->setConstant(false);
-			
-			llvm::Value* zero = llvm::ConstantInt::get(llvm::Type::getInt32Ty(context), 0);
-			llvm::Value* Args[] = { zero, zero };
-			return builder.CreateInBoundsGEP(str->getValueType(), str, Args, "string_literal_gep");
+			if(function.hasLocalLinkage() || function.isIntrinsic() || into.getFunction(function.getName()))
+				continue;
+
+			llvm::Function* declaration = llvm::Function::Create(function.getFunctionType(), llvm::Function::ExternalLinkage, function.getName(), into);
+			declaration->copyAttributesFrom(&function);
+			if(SourceTypes.count(&function))
+				SourceTypes[declaration] = SourceTypes[&function];
 		}
-		
-		if(auto ret = dynamic_cast<Return*>(k.get()))
+
+		for(auto& global : from.globals())
 		{
-			llvm::Value* retval = generateIr(ret->getValue(), scope, builder, module);
-			if(!retval) return nullptr;
-			
-			auto value = builder.CreateRet(retval);
-			scope.exit();
-			return value;
+			if(global.hasLocalLinkage() || into.getNamedGlobal(global.getName()))
+				continue;
+
+			auto* declaration = new llvm::GlobalVariable(into, global.getValueType(), global.isConstant(), llvm::GlobalValue::ExternalLinkage,
+				nullptr, global.getName(), nullptr, global.getThreadLocalMode());
+			if(AtomicValues.count(&global))
+				AtomicValues.insert(declaration);
 		}
-		
-		if(auto call = dynamic_cast<FunctionCall*>(k.get()))
+	}
+
+	void generateReplEntry(std::vector<std::shared_ptr<Expr>>& statements, const std::string& name, llvm::IRBuilder<>& builder, llvm::Module* module)
+	{
+		llvm::Function* entry = llvm::Function::Create(llvm::FunctionType::get(builder.getVoidTy(), false), llvm::Function::ExternalLinkage, name, module);
+		applyTargetAttributes(entry);
+		builder.SetInsertPoint(llvm::BasicBlock::Create(context, "entry", entry));
+
+		LocalScope::Scope locals;
+		ReplScope.addLevel(&locals);
+
+		// A lone expression is printed like a calculator would
+		auto* result = (statements.size() == 1 ? dynamic_cast<Return*>(statements[0].get()) : nullptr);
+		if(result && result->getValue())
 		{
-			// Handle include
-			if(call->getName() == "include")
-				return nullptr;
-			
-			std::vector<llvm::Value*> args;	
-			for(auto& p : call->getArgs()) //args.push_back(var2val(builder, generateIr(p, scope, builder, module)));
-			{
-				llvm::Value* value = generateIr(p, scope, builder, module);
-				if(!value) return nullptr;
-				args.push_back(value);
-			}
-			
-			std::string funcname = call->getName();
-			if(call->isMethod())
-			{
-				llvm::Value* self = args[0];
-				
-				if(self->getType()->isPointerTy())
-					funcname = type2str(self->getType()->getPointerElementType()) + "_" + funcname;
-				else
-				{
-					funcname = type2str(self->getType()) + "_" + funcname;
-					args[0] = generateIr(std::make_shared<UnaryOp>(call->getArgs()[0], "@"), scope, builder, module);
-				}
-			}
-			
-			llvm::Function* calleeFunc = module->getFunction(funcname);
-			if(!calleeFunc)
-			{
-				error("undefined function '" + call->getName() + "'", call->getLocation());
-				return nullptr;
-			}
-			
-			// Check types
-			{
-				if(!calleeFunc->isVarArg() && calleeFunc->arg_size() != args.size())
-				{
-					error("argument count mismatch, required " 
-						+ std::to_string(calleeFunc->arg_size())
-						+ " but given " + std::to_string(args.size()), call->getLocation());
-					return nullptr;
-				}
-				
-				auto iter = args.begin();
-				size_t i = 0;
-				for(auto& arg : calleeFunc->args())
-				{
-					if((*iter)->getType() != arg.getType())
-					{
-						error("argument type mismatch, expected '" 
-						+ type2str(arg.getType())
-						+ "' but got '" + type2str((*iter)->getType()), call->getArgs()[i]->getLocation());
-					
-						return nullptr;
-					}
-					
-					i++;
-					iter++;
-				}
-			}
-			
-			llvm::ArrayRef<llvm::Value*> argsRef(args);
-			
-			scope.exit();
-			if(!calleeFunc->getFunctionType()->getReturnType()->isVoidTy())
-				return builder.CreateCall(calleeFunc, argsRef, "call");
-			else
-				return builder.CreateCall(calleeFunc, argsRef);
+			if(llvm::Value* value = generateIr(result->getValue(), ReplScope, builder, module))
+				printValue(value, builder, module);
 		}
-		
-		scope.exit();
-		return nullptr;
+		else
+		{
+			for(auto& statement : statements)
+				generateIr(statement, ReplScope, builder, module);
+		}
+
+		ReplScope.exit();
+		if(!builder.GetInsertBlock()->getTerminator())
+			builder.CreateRetVoid();
 	}
-	
-	void generateIr(std::vector<std::shared_ptr<Expr>>& expressions, LocalScope& scope, llvm::IRBuilder<>& builder, llvm::Module* module)
+
+	void printValue(llvm::Value* value, llvm::IRBuilder<>& builder, llvm::Module* module)
 	{
-		for(auto& k : expressions)
+		llvm::Type* type = value->getType();
+		std::string format;
+		if(type->isVoidTy())
+			return;
+		else if(type->isIntegerTy(1))
 		{
-			generateIr(k, scope, builder, module);
+			value = builder.CreateSelect(value, builder.CreateGlobalStringPtr("true"), builder.CreateGlobalStringPtr("false"), "bool_name");
+			format = "%s\n";
+		}
+		else if(type->isIntegerTy(64))
+			format = "%lld\n";
+		else if(type->isIntegerTy())
+		{
+			value = builder.CreateSExtOrTrunc(value, builder.getInt32Ty(), "print_int");
+			format = "%d\n";
+		}
+		else if(type->isFloatingPointTy())
+		{
+			if(!type->isDoubleTy())
+				value = builder.CreateFPExt(value, builder.getDoubleTy(), "print_double");
+			format = "%g\n";
 		}
+		else if(type->isPointerTy())
+			format = "%p\n";
+		else
+		{
+			format = "<" + type2str(type) + ">\n";
+			value = nullptr;
+		}
+
+		auto printf = module->getOrInsertFunction("printf", llvm::FunctionType::get(builder.getInt32Ty(), {builder.getInt8PtrTy()}, true));
+		std::vector<llvm::Value*> args = {builder.CreateGlobalStringPtr(format, "print_format")};
+		if(value)
+			args.push_back(value);
+		builder.CreateCall(printf, args);
 	}
-	
+
 	void writeLlvm(const std::string& where)
 	{
-		// Get a list of required librarie and
-		// llvm::Linker::link them.
-		preprocess();
-		// dump();
-
-		llvm::Module* module = new llvm::Module(where, context);
-		llvm::IRBuilder<> builder(context); 
-		
-		LocalScope scope;
-		generateIr(TopLevel, scope, builder, module);
-		
+		std::unique_ptr<llvm::Module> module = generateLlvm(where);
 		//module->dump();
 				
 		std::error_code error;
@@ -1654,7 +4239,17 @@ public:
 		
 		for(auto& k : TopLevel)
 		{
-			out << k->getDefinitionString();
+			auto function = dynamic_cast<Function*>(k.get());
+			auto classdef = dynamic_cast<ClassDef*>(k.get());
+
+			// Instances are recreated by every user of a template
+			if((function && function->isTemplateInstance()) || (classdef && classdef->isTemplateInstance()))
+				continue;
+
+			if((function && function->isTemplate()) || (classdef && classdef->isTemplate()))
+				out << Monomorphizer::toSource(k.get()) << "\n";
+			else
+				out << k->getDefinitionString();
 		}
 		
 		out.close();
@@ -1670,21 +4265,37 @@ public:
 		return ss.str();
 	}
 	
-	void preprocess()
+	// Entries in front of first were handled by an earlier call
+	void preprocess(size_t first = 0)
 	{
 		// First: Execute all meta blocks
 		{
-			MetaContext metaCtx;
-			for (auto& k : TopLevel)
-				if (auto meta = dynamic_cast<Meta*>(k.get()))
+			MetaContext& metaCtx = MetaContext::shared();
+			for (size_t i = first; i < TopLevel.size();)
+			{
+				auto meta = dynamic_cast<Meta*>(TopLevel[i].get());
+				if(!meta)
 				{
-					metaCtx.apply(*this, meta);
+					i++;
+					continue;
 				}
+
+				// Keep the block alive and find it again, it may splice entries in front of itself.
+				// A block removing itself continues with whatever took its place.
+				auto block = TopLevel[i];
+				metaCtx.apply(*this, meta);
+
+				auto self = std::find(TopLevel.begin() + std::min(first, TopLevel.size()), TopLevel.end(), block);
+				if(self != TopLevel.end())
+					i = (self - TopLevel.begin()) + 1;
+				else
+					i = std::min(i, TopLevel.size());
+			}
 		}
 
 		// Ugly?
 		static std::unordered_map<std::string, bool> visitedFiles;
-		for(size_t i = 0;  i < TopLevel.size(); i++)
+		for(size_t i = first;  i < TopLevel.size(); i++)
 		{
 			auto& k = TopLevel[i];
 			if(auto call = dynamic_cast<FunctionCall*>(k.get()))
@@ -1769,6 +4380,13 @@ public:
 				}
 			}
 		}
+
+		// Generic classes are instantiated in front of their first user
+		Generics.instantiateClasses();
+
+		// Evaluate constant initializers now that all definitions are known
+		Interpreter interpreter(*this);
+		interpreter.foldConstants();
 	}
 
 	void matchTypes(std::string typeA, std::string typeB, AST::Expr* expr)
@@ -1813,12 +4431,282 @@ public:
 		return normalizeName("Operator_" + op + "_" + argL + "_" + argR);
 	}
 	
+	void setGlobalLinkage(VariableDef* var, llvm::GlobalVariable* global)
+	{
+		// Common symbols can not be constant
+		if(var->getConst())
+		{
+			global->setConstant(true);
+			global->setLinkage(llvm::GlobalValue::ExternalLinkage);
+		}
+		else if(var->getThreadLocal())
+			global->setLinkage(llvm::GlobalValue::ExternalLinkage);
+		else
+			global->setLinkage(llvm::GlobalValue::CommonLinkage);
+
+		setThreadLocal(var, global);
+	}
+
+	void setThreadLocal(VariableDef* var, llvm::GlobalVariable* global)
+	{
+		if(!var->getThreadLocal())
+			return;
+
+		// Programs know the offset of their own variables from the thread pointer,
+		// modules and declarations only know the variable is in the executable
+		if(var->getExtern() || Flags.isModule)
+			global->setThreadLocalMode(llvm::GlobalValue::InitialExecTLSModel);
+		else
+			global->setThreadLocalMode(llvm::GlobalValue::LocalExecTLSModel);
+	}
+
+	void applyFunctionAttributes(Function* function, llvm::Function* llvmFunction)
+	{
+		for(auto& attribute : function->getAttributes())
+		{
+			if(attribute == "inline")
+				llvmFunction->addFnAttr(llvm::Attribute::AlwaysInline);
+			else if(attribute == "noinline")
+				llvmFunction->addFnAttr(llvm::Attribute::NoInline);
+			else if(attribute == "hot")
+				llvmFunction->addFnAttr(llvm::Attribute::Hot);
+			else if(attribute == "cold")
+			{
+				// Keep cold paths small, they are not worth the code size
+				llvmFunction->addFnAttr(llvm::Attribute::Cold);
+				if(!function->getExtern())
+					llvmFunction->addFnAttr(llvm::Attribute::OptimizeForSize);
+			}
+			else if(attribute == "pure" || attribute == "readonly")
+				llvmFunction->addFnAttr(llvm::Attribute::ReadOnly);
+			else if(attribute == "nounwind")
+				llvmFunction->addFnAttr(llvm::Attribute::NoUnwind);
+			else if(attribute == "noreturn")
+				llvmFunction->addFnAttr(llvm::Attribute::NoReturn);
+			else if(isFastMathAttribute(attribute) || attribute.compare(0, 12, "multiversion") == 0)
+				continue;
+			else
+				error("unknown function attribute '" + attribute + "'", function->getLocation());
+		}
+
+		if(function->hasAttribute("inline") && function->hasAttribute("noinline"))
+			error("function can not be both 'inline' and 'noinline'", function->getLocation());
+
+		if(function->hasAttribute("hot") && function->hasAttribute("cold"))
+			error("function can not be both 'hot' and 'cold'", function->getLocation());
+	}
+
+	void applyTargetAttributes(llvm::Function* function)
+	{
+		if(!TargetCpu.empty())
+			function->addFnAttr("target-cpu", TargetCpu);
+		if(!TargetFeatures.empty())
+			function->addFnAttr("target-features", TargetFeatures);
+	}
+
+	static bool isMultiversioned(Function* function)
+	{
+		for(auto& attribute : function->getAttributes())
+			if(attribute == "multiversion" || attribute.compare(0, 13, "multiversion(") == 0)
+				return true;
+		return false;
+	}
+
+	// x86-64 ISA levels and the bits they need in __cpu_model.__cpu_features[0] and
+	// in __cpu_features2, which holds feature 32 and up. The bit numbers are the ones
+	// of libgcc and compiler-rt, runtimes too old to fill __cpu_features2 only get
+	// the baseline version.
+	struct IsaLevel
+	{
+		int Level;
+		const char* Cpu;
+		uint32_t Features;
+		uint32_t Features2[2];
+	};
+
+	static const std::vector<IsaLevel>& getIsaLevels()
+	{
+		static const uint32_t v2 = (1u << 2) | (1u << 5) | (1u << 6) | (1u << 7) | (1u << 8); // POPCNT, SSE3, SSSE3, SSE4.1, SSE4.2
+		static const uint32_t v2Low = (1u << (46 - 32)) | (1u << (54 - 32)); // CMPXCHG16B, LAHF-SAHF
+		static const uint32_t v3 = v2 | (1u << 9) | (1u << 10) | (1u << 14) | (1u << 16) | (1u << 17); // AVX, AVX2, FMA, BMI, BMI2
+		static const uint32_t v3Low = v2Low | (1u << (49 - 32)) | (1u << (57 - 32)) | (1u << (58 - 32)); // F16C, LZCNT, MOVBE
+		static const uint32_t v3High = (1u << (81 - 64)); // XSAVE
+		static const uint32_t v4 = v3 | (1u << 15) | (1u << 20) | (1u << 21) | (1u << 22) | (1u << 23); // AVX-512 F, VL, BW, DQ, CD
+		static const std::vector<IsaLevel> levels = {
+			{2, "x86-64-v2", v2, {v2Low, 0}},
+			{3, "x86-64-v3", v3, {v3Low, v3High}},
+			{4, "x86-64-v4", v4, {v3Low, v3High}}};
+		return levels;
+	}
+
+	// [[multiversion]] compiles the function for baseline x86-64, AVX2 and AVX-512,
+	// [[multiversion(n)]] starts at x86-64-vn instead of AVX2. An ifunc picks the
+	// best version when the program is loaded.
+	void createMultiversion(Function* function, llvm::Function* original, llvm::Module* module)
+	{
+		if(llvm::Triple(module->getTargetTriple()).getArch() != llvm::Triple::x86_64)
+		{
+			error("multiversioning needs an x86-64 target", function->getLocation());
+			return;
+		}
+
+		if(function->isAsync())
+		{
+			error("async functions can not be multiversioned", function->getLocation());
+			return;
+		}
+
+		int lowest = 3;
+		for(auto& attribute : function->getAttributes())
+			if(attribute.compare(0, 13, "multiversion(") == 0)
+				lowest = std::stoi(attribute.substr(13));
+
+		if(lowest < 2 || lowest > 4)
+		{
+			error("multiversioning supports the ISA levels 2 to 4", function->getLocation());
+			return;
+		}
+
+		std::string name = original->getName().str();
+		auto linkage = original->getLinkage();
+		original->setName(name + ".default");
+		original->setLinkage(llvm::GlobalValue::InternalLinkage);
+
+		// Every call, including recursive ones, goes through the dispatch
+		llvm::Type* resolverType = llvm::FunctionType::get(original->getType(), false);
+		llvm::Function* resolver = llvm::Function::Create(llvm::cast<llvm::FunctionType>(resolverType),
+			llvm::GlobalValue::InternalLinkage, name + ".resolver", module);
+		auto* ifunc = llvm::GlobalIFunc::create(original->getFunctionType(), 0, linkage, name, resolver, module);
+		original->replaceAllUsesWith(ifunc);
+
+		std::vector<std::pair<const IsaLevel*, llvm::Function*>> versions;
+		for(auto& level : getIsaLevels())
+		{
+			if(level.Level < lowest)
+				continue;
+
+			llvm::ValueToValueMapTy mapping;
+			llvm::Function* version = llvm::CloneFunction(original, mapping);
+			version->setName(name + "." + level.Cpu);
+			version->addFnAttr("target-cpu", level.Cpu);
+			version->removeFnAttr("target-features");
+			versions.emplace_back(&level, version);
+		}
+
+		original->addFnAttr("target-cpu", "x86-64");
+		original->removeFnAttr("target-features");
+
+		// The resolver runs before constructors, so it fills __cpu_model itself
+		llvm::IRBuilder<> builder(llvm::BasicBlock::Create(context, "entry", resolver));
+		llvm::StructType* modelType = llvm::StructType::get(context, {builder.getInt32Ty(), builder.getInt32Ty(), builder.getInt32Ty(),
+			llvm::ArrayType::get(builder.getInt32Ty(), 1)});
+		llvm::Constant* model = module->getOrInsertGlobal("__cpu_model", modelType);
+		builder.CreateCall(module->getOrInsertFunction("__cpu_indicator_init", builder.getVoidTy()));
+
+		llvm::Value* indices[] = {builder.getInt32(0), builder.getInt32(3), builder.getInt32(0)};
+		llvm::Value* features = builder.CreateLoad(builder.getInt32Ty(), builder.CreateInBoundsGEP(modelType, model, indices), "cpu_features");
+
+		llvm::ArrayType* features2Type = llvm::ArrayType::get(builder.getInt32Ty(), 2);
+		llvm::Constant* features2 = module->getOrInsertGlobal("__cpu_features2", features2Type);
+		llvm::Value* words[] = {
+			builder.CreateLoad(builder.getInt32Ty(), builder.CreateConstInBoundsGEP2_32(features2Type, features2, 0, 0), "cpu_features2"),
+			builder.CreateLoad(builder.getInt32Ty(), builder.CreateConstInBoundsGEP2_32(features2Type, features2, 0, 1), "cpu_features3")};
+
+		for(auto version = versions.rbegin(); version != versions.rend(); version++)
+		{
+			auto has = [&](llvm::Value* word, uint32_t bits) {
+				llvm::Value* mask = builder.getInt32(bits);
+				return builder.CreateICmpEQ(builder.CreateAnd(word, mask), mask);
+			};
+
+			llvm::Value* supported = builder.CreateAnd({has(features, version->first->Features),
+				has(words[0], version->first->Features2[0]), has(words[1], version->first->Features2[1])});
+			supported->setName("supported");
+
+			llvm::BasicBlock* use = llvm::BasicBlock::Create(context, version->first->Cpu, resolver);
+			llvm::BasicBlock* next = llvm::BasicBlock::Create(context, "next", resolver);
+			builder.CreateCondBr(supported, use, next);
+
+			builder.SetInsertPoint(use);
+			builder.CreateRet(version->second);
+			builder.SetInsertPoint(next);
+		}
+
+		builder.CreateRet(original);
+	}
+
+	static bool isFastMathAttribute(const std::string& name)
+	{
+		for(const char* flag : {"fastmath", "nofastmath", "reassoc", "contract", "nnan", "ninf", "nsz", "arcp", "afn"})
+			if(name == flag)
+				return true;
+		return false;
+	}
+
+	// The module wide -ffast-math default refined by the attributes of the function
+	llvm::FastMathFlags getFastMathFlags(Function* function, llvm::Function* llvmFunction)
+	{
+		llvm::FastMathFlags flags;
+		if(Flags.fastMath && !function->hasAttribute("nofastmath"))
+			flags.setFast();
+
+		for(auto& attribute : function->getAttributes())
+		{
+			if(attribute == "fastmath")
+				flags.setFast();
+			else if(attribute == "reassoc")
+				flags.setAllowReassoc();
+			else if(attribute == "contract")
+				flags.setAllowContract();
+			else if(attribute == "nnan")
+				flags.setNoNaNs();
+			else if(attribute == "ninf")
+				flags.setNoInfs();
+			else if(attribute == "nsz")
+				flags.setNoSignedZeros();
+			else if(attribute == "arcp")
+				flags.setAllowReciprocal();
+			else if(attribute == "afn")
+				flags.setApproxFunc();
+			else if(attribute == "nofastmath" && function->getAttributes().size() > 1)
+			{
+				for(auto& other : function->getAttributes())
+					if(other != attribute && isFastMathAttribute(other))
+						error("function can not be both 'nofastmath' and '" + other + "'", function->getLocation());
+			}
+		}
+
+		// The backend needs to know as well, e.g. to drop signed zeros when selecting instructions
+		if(flags.isFast())
+			llvmFunction->addFnAttr("unsafe-fp-math", "true");
+		if(flags.noNaNs())
+			llvmFunction->addFnAttr("no-nans-fp-math", "true");
+		if(flags.noInfs())
+			llvmFunction->addFnAttr("no-infs-fp-math", "true");
+		if(flags.noSignedZeros())
+			llvmFunction->addFnAttr("no-signed-zeros-fp-math", "true");
+		if(flags.approxFunc())
+			llvmFunction->addFnAttr("approx-func-fp-math", "true");
+
+		return flags;
+	}
+
 	Function* findFunction(const std::string& name)
 	{
 		Function* fn;
 		for(auto& k : TopLevel)
 			if((fn = dynamic_cast<Function*>(k.get())) && fn->getName() == name)
 				return fn;
+		return nullptr;
+	}
+
+	VariableDef* findGlobal(const std::string& name)
+	{
+		VariableDef* var;
+		for(auto& k : TopLevel)
+			if((var = dynamic_cast<VariableDef*>(k.get())) && var->getName() == name)
+				return var;
+		return nullptr;
 	}
 	
 	llvm::FunctionType* getFunctionTypeFromName(llvm::IRBuilder<>& builder, llvm::Module* module, const std::string& name, bool vararg, llvm::ArrayRef<llvm::Type*> args = nullptr)
@@ -1844,6 +4732,10 @@ public:
 		{
 			retval = builder.getInt32Ty();
 		}
+		else if(type == "int64")
+		{
+			retval = builder.getInt64Ty();
+		}
 		else if(type == "bool")
 		{
 			retval = builder.getInt1Ty();
@@ -1860,6 +4752,31 @@ public:
 		{
 			retval = builder.getInt8Ty();
 		}
+		else if(type.compare(0, 2, "[]") == 0)
+		{
+			// Slices view length elements starting at data
+			llvm::Type* element = getType(builder, type.substr(2), module);
+			if(!element)
+				return nullptr;
+
+			retval = llvm::StructType::getTypeByName(context, type);
+			if(!retval)
+				retval = llvm::StructType::create(context, {element->getPointerTo(), builder.getInt32Ty()}, type);
+		}
+		else if(type[0] == '(')
+		{
+			// Results of a function returning several values
+			std::vector<llvm::Type*> fields;
+			for(auto& field : Monomorphizer::splitTypeArgs(type.substr(1, type.size() - 2)))
+			{
+				llvm::Type* fieldType = getType(builder, field, module);
+				if(!fieldType)
+					return nullptr;
+				fields.push_back(fieldType);
+			}
+
+			retval = llvm::StructType::get(context, fields);
+		}
 		else
 		{
 			if(module)
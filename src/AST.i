@@ -2,6 +2,7 @@
 
 %{
 #include <AST.h>
+#include <MetaModule.h>
 using namespace AST;
 %}
 
@@ -11,3 +12,4 @@ using namespace AST;
 %include <std_vector.i>
 
 %include <AST.h>
+%include <MetaModule.h>
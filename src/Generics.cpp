@@ -0,0 +1,780 @@
+#include "Generics.h"
+#include "AST.h"
+#include <cmath>
+#include <cstdio>
+
+using namespace AST;
+
+static bool isIdentifierChar(char c)
+{
+	return isalnum(c) || c == '_';
+}
+
+std::string Monomorphizer::substitute(const std::string& type, const Bindings& bindings)
+{
+	std::string result;
+	for(size_t i = 0; i < type.size();)
+	{
+		if(!isIdentifierChar(type[i]))
+		{
+			result += type[i++];
+			continue;
+		}
+
+		size_t start = i;
+		while(i < type.size() && isIdentifierChar(type[i]))
+			i++;
+
+		std::string name = type.substr(start, i - start);
+		auto binding = bindings.find(name);
+		result += (binding != bindings.end() ? binding->second : name);
+	}
+
+	return result;
+}
+
+std::vector<std::string> Monomorphizer::splitTypeArgs(const std::string& args)
+{
+	std::vector<std::string> result;
+	int depth = 0;
+	size_t start = 0;
+
+	for(size_t i = 0; i < args.size(); i++)
+	{
+		if(args[i] == '<')
+			depth++;
+		else if(args[i] == '>')
+			depth--;
+		else if(args[i] == ',' && depth == 0)
+		{
+			result.push_back(args.substr(start, i - start));
+			start = i + 1;
+		}
+	}
+
+	result.push_back(args.substr(start));
+	return result;
+}
+
+void Monomorphizer::findGenericTypes(const std::string& type, std::vector<std::string>& result)
+{
+	for(size_t i = 0; i < type.size();)
+	{
+		if(!isIdentifierChar(type[i]))
+		{
+			i++;
+			continue;
+		}
+
+		size_t start = i;
+		while(i < type.size() && isIdentifierChar(type[i]))
+			i++;
+
+		if(i >= type.size() || type[i] != '<')
+			continue;
+
+		size_t open = i;
+		int depth = 0;
+		for(; i < type.size(); i++)
+		{
+			if(type[i] == '<')
+				depth++;
+			else if(type[i] == '>' && --depth == 0)
+				break;
+		}
+
+		// Arguments have to exist before the type using them
+		findGenericTypes(type.substr(open + 1, i - open - 1), result);
+		result.push_back(type.substr(start, i - start + 1));
+		i++;
+	}
+}
+
+void Monomorphizer::collectTypes(Expr* expr, std::vector<std::string>& types)
+{
+	if(!expr)
+		return;
+
+	auto collectBody = [&types](std::vector<std::shared_ptr<Expr>>& body) {
+		for(auto& k : body)
+			collectTypes(k.get(), types);
+	};
+
+	if(auto var = dynamic_cast<VariableDef*>(expr))
+	{
+		types.push_back(var->getType());
+		collectTypes(var->getInitial().get(), types);
+	}
+	else if(auto fn = dynamic_cast<Function*>(expr))
+	{
+		if(fn->isTemplate())
+			return;
+
+		types.push_back(fn->getReturnType());
+		collectBody(fn->getArgs());
+		collectBody(fn->getBody());
+	}
+	else if(auto classdef = dynamic_cast<ClassDef*>(expr))
+	{
+		if(classdef->isTemplate())
+			return;
+
+		collectBody(classdef->getBody());
+	}
+	else if(auto cast = dynamic_cast<TypeCast*>(expr))
+	{
+		types.push_back(cast->getType());
+		collectTypes(cast->getValue().get(), types);
+	}
+	else if(auto iffi = dynamic_cast<If*>(expr))
+	{
+		collectTypes(iffi->getHead().get(), types);
+		collectBody(iffi->getBody());
+		collectBody(iffi->getElse());
+	}
+	else if(auto whily = dynamic_cast<While*>(expr))
+	{
+		collectTypes(whily->getHead().get(), types);
+		collectBody(whily->getBody());
+	}
+	else if(auto fory = dynamic_cast<RangeFor*>(expr))
+	{
+		collectTypes(fory->getRange().get(), types);
+		collectBody(fory->getBody());
+	}
+	else if(auto fory = dynamic_cast<For*>(expr))
+	{
+		collectTypes(fory->getInit().get(), types);
+		collectTypes(fory->getCond().get(), types);
+		collectTypes(fory->getInc().get(), types);
+		if(auto parallel = dynamic_cast<ParallelFor*>(fory))
+			collectTypes(parallel->getGrain().get(), types);
+		collectBody(fory->getBody());
+	}
+	else if(auto binop = dynamic_cast<BinaryOp*>(expr))
+	{
+		collectTypes(binop->getLeft().get(), types);
+		collectTypes(binop->getRight().get(), types);
+	}
+	else if(auto op = dynamic_cast<UnaryOp*>(expr))
+		collectTypes(op->getExp().get(), types);
+	else if(auto ret = dynamic_cast<Return*>(expr))
+		collectTypes(ret->getValue().get(), types);
+	else if(auto yield = dynamic_cast<Yield*>(expr))
+		collectTypes(yield->getValue().get(), types);
+	else if(auto await = dynamic_cast<Await*>(expr))
+		collectTypes(await->getValue().get(), types);
+	else if(auto call = dynamic_cast<FunctionCall*>(expr))
+		collectBody(call->getArgs());
+	else if(auto array = dynamic_cast<ArrayLiteral*>(expr))
+		collectBody(array->getValues());
+	else if(auto list = dynamic_cast<ValueList*>(expr))
+		collectBody(list->getValues());
+	else if(auto unpack = dynamic_cast<Unpack*>(expr))
+	{
+		collectBody(unpack->getTargets());
+		collectBody(unpack->getValues());
+	}
+}
+
+ClassDef* Monomorphizer::findClassTemplate(const std::string& name)
+{
+	ClassDef* classdef;
+	for(auto& k : module.getTopLevel())
+		if((classdef = dynamic_cast<ClassDef*>(k.get())) && classdef->isTemplate() && classdef->getName() == name)
+			return classdef;
+	return nullptr;
+}
+
+void Monomorphizer::instantiateClasses()
+{
+	auto& toplevel = module.getTopLevel();
+	for(size_t i = 0; i < toplevel.size(); i++)
+	{
+		std::vector<std::shared_ptr<ClassDef>> instances;
+		instantiateClasses(toplevel[i].get(), instances);
+
+		toplevel.insert(toplevel.begin() + i, instances.begin(), instances.end());
+		i += instances.size();
+	}
+}
+
+void Monomorphizer::instantiateClasses(Expr* expr, std::vector<std::shared_ptr<ClassDef>>& result)
+{
+	std::vector<std::string> types;
+	collectTypes(expr, types);
+
+	for(auto& type : types)
+	{
+		std::vector<std::string> generics;
+		findGenericTypes(type, generics);
+
+		for(auto& name : generics)
+		{
+			if(ClassInstances.count(name))
+				continue;
+
+			auto instance = instantiateClass(name, expr);
+			if(!instance)
+				continue;
+
+			instantiateClasses(instance.get(), result);
+			result.push_back(instance);
+		}
+	}
+}
+
+std::shared_ptr<ClassDef> Monomorphizer::instantiateClass(const std::string& name, Expr* where)
+{
+	// Also remember failed instances so errors are only reported once
+	ClassInstances.insert(name);
+
+	size_t open = name.find('<');
+	const std::string base = name.substr(0, open);
+	auto args = splitTypeArgs(name.substr(open + 1, name.size() - open - 2));
+
+	ClassDef* templ = findClassTemplate(base);
+	if(!templ)
+	{
+		module.error("'" + base + "' is not a generic class", where->getLocation());
+		return nullptr;
+	}
+
+	auto& params = templ->getTypeParams();
+	if(params.size() != args.size())
+	{
+		module.error("'" + base + "' expects " + std::to_string(params.size())
+					 + " type arguments but got " + std::to_string(args.size()), where->getLocation());
+		return nullptr;
+	}
+
+	Bindings bindings;
+	for(size_t i = 0; i < params.size(); i++)
+		bindings[params[i]] = args[i];
+
+	auto instance = std::make_shared<ClassDef>(name);
+	instance->setLocation(templ->getLocation());
+	instance->setTemplateInstance(true);
+
+	for(auto& k : templ->getBody())
+	{
+		auto copy = clone(k.get(), bindings);
+		instance->getBody().push_back(copy);
+
+		if(auto fn = std::dynamic_pointer_cast<Function>(copy))
+		{
+			fn->setMember(true);
+			fn->setTemplateInstance(true);
+			instance->getMethods().push_back(fn);
+		}
+		else if(auto var = std::dynamic_pointer_cast<VariableDef>(copy))
+			instance->getFields().push_back(var);
+	}
+
+	return instance;
+}
+
+bool Monomorphizer::unify(const std::vector<std::string>& params, std::string param, std::string arg, Bindings& bindings)
+{
+	if(param.compare(0, 9, "restrict ") == 0)
+		param.erase(0, 9);
+
+	// Pointers and slices of T match pointers and slices of the argument type
+	while(!param.empty() && !arg.empty() && param[0] == arg[0] && (param[0] == '@' || param.compare(0, 2, "[]") == 0))
+	{
+		size_t length = (param[0] == '@' ? 1 : 2);
+		param.erase(0, length);
+		arg.erase(0, length);
+	}
+
+	for(auto& p : params)
+		if(param == p)
+		{
+			auto bound = bindings.find(p);
+			if(bound != bindings.end())
+				return bound->second == arg;
+
+			bindings[p] = arg;
+			return true;
+		}
+
+	size_t paramOpen = param.find('<');
+	size_t argOpen = arg.find('<');
+	if(paramOpen == std::string::npos)
+		return true; // Concrete types are checked by the call itself
+
+	if(argOpen == std::string::npos || param.substr(0, paramOpen) != arg.substr(0, argOpen))
+		return false;
+
+	auto paramArgs = splitTypeArgs(param.substr(paramOpen + 1, param.size() - paramOpen - 2));
+	auto argArgs = splitTypeArgs(arg.substr(argOpen + 1, arg.size() - argOpen - 2));
+	if(paramArgs.size() != argArgs.size())
+		return false;
+
+	for(size_t i = 0; i < paramArgs.size(); i++)
+		if(!unify(params, paramArgs[i], argArgs[i], bindings))
+			return false;
+
+	return true;
+}
+
+std::shared_ptr<Function> Monomorphizer::instantiateFunction(Function* function, const std::vector<std::string>& argTypes, Expr* where)
+{
+	auto& args = function->getArgs();
+	if(args.size() != argTypes.size())
+	{
+		module.error("argument count mismatch, required " + std::to_string(args.size())
+					 + " but given " + std::to_string(argTypes.size()), where->getLocation());
+		return nullptr;
+	}
+
+	Bindings bindings;
+	for(size_t i = 0; i < args.size(); i++)
+	{
+		const std::string type = static_cast<VariableDef*>(args[i].get())->getType();
+		if(!unify(function->getTypeParams(), type, argTypes[i], bindings))
+		{
+			module.error("can not use '" + argTypes[i] + "' as '" + type + "' in call to '"
+						 + function->getName() + "'", where->getLocation());
+			return nullptr;
+		}
+	}
+
+	std::string name = function->getName() + "<";
+	for(auto& p : function->getTypeParams())
+	{
+		if(!bindings.count(p))
+		{
+			module.error("could not deduce type parameter '" + p + "' of '" + function->getName() + "'", where->getLocation());
+			return nullptr;
+		}
+
+		name += bindings[p] + (p != function->getTypeParams().back() ? "," : "");
+	}
+	name += ">";
+
+	auto cached = FunctionInstances.find(name);
+	if(cached != FunctionInstances.end())
+		return cached->second;
+
+	auto instance = std::static_pointer_cast<Function>(clone(function, bindings));
+	instance->getTypeParams().clear();
+	instance->setName(name);
+	instance->setTemplateInstance(true);
+
+	FunctionInstances[name] = instance;
+	return instance;
+}
+
+std::shared_ptr<Expr> Monomorphizer::clone(Expr* expr, const Bindings& bindings)
+{
+	if(!expr)
+		return nullptr;
+
+	auto cloneBody = [&bindings](std::vector<std::shared_ptr<Expr>>& from, std::vector<std::shared_ptr<Expr>>& to) {
+		for(auto& k : from)
+			to.push_back(clone(k.get(), bindings));
+	};
+
+	std::shared_ptr<Expr> result;
+	if(auto cast = dynamic_cast<TypeCast*>(expr))
+		result = std::make_shared<TypeCast>(substitute(cast->getType(), bindings), clone(cast->getValue().get(), bindings));
+	else if(auto v = dynamic_cast<Number*>(expr))
+		result = std::make_shared<Number>(v->getValue());
+	else if(auto v = dynamic_cast<Integer*>(expr))
+		result = std::make_shared<Integer>(v->getValue());
+	else if(auto v = dynamic_cast<Bool*>(expr))
+		result = std::make_shared<Bool>(v->getValue());
+	else if(auto v = dynamic_cast<Byte*>(expr))
+		result = std::make_shared<Byte>(v->getValue());
+	else if(auto v = dynamic_cast<String*>(expr))
+		result = std::make_shared<String>(v->getValue());
+	else if(auto iffi = dynamic_cast<If*>(expr))
+	{
+		auto copy = std::make_shared<If>(clone(iffi->getHead().get(), bindings));
+		cloneBody(iffi->getBody(), copy->getBody());
+		cloneBody(iffi->getElse(), copy->getElse());
+		result = copy;
+	}
+	else if(auto whily = dynamic_cast<While*>(expr))
+	{
+		auto copy = std::make_shared<While>(clone(whily->getHead().get(), bindings));
+		cloneBody(whily->getBody(), copy->getBody());
+		result = copy;
+	}
+	else if(auto fory = dynamic_cast<ParallelFor*>(expr))
+	{
+		auto copy = std::make_shared<ParallelFor>(clone(fory->getInit().get(), bindings),
+												  clone(fory->getCond().get(), bindings),
+												  clone(fory->getInc().get(), bindings),
+												  clone(fory->getGrain().get(), bindings));
+		copy->getReductions() = fory->getReductions();
+		cloneBody(fory->getBody(), copy->getBody());
+		result = copy;
+	}
+	else if(auto fory = dynamic_cast<RangeFor*>(expr))
+	{
+		auto copy = std::make_shared<RangeFor>(fory->getIndex(), fory->getValue(), clone(fory->getRange().get(), bindings));
+		cloneBody(fory->getBody(), copy->getBody());
+		result = copy;
+	}
+	else if(auto fory = dynamic_cast<For*>(expr))
+	{
+		auto copy = std::make_shared<For>(clone(fory->getInit().get(), bindings),
+										  clone(fory->getCond().get(), bindings),
+										  clone(fory->getInc().get(), bindings));
+		cloneBody(fory->getBody(), copy->getBody());
+		result = copy;
+	}
+	else if(auto var = dynamic_cast<VariableDef*>(expr))
+	{
+		auto copy = std::make_shared<VariableDef>(var->getName(), substitute(var->getType(), bindings),
+												  clone(var->getInitial().get(), bindings), var->getSize());
+		copy->setExtern(var->getExtern());
+		copy->setConst(var->getConst());
+		copy->setAtomic(var->getAtomic());
+		copy->setThreadLocal(var->getThreadLocal());
+		result = copy;
+	}
+	else if(auto fn = dynamic_cast<Function*>(expr))
+	{
+		auto copy = std::make_shared<Function>(fn->getName(), substitute(fn->getReturnType(), bindings), fn->getExtern());
+		cloneBody(fn->getArgs(), copy->getArgs());
+		cloneBody(fn->getBody(), copy->getBody());
+		copy->setVariadic(fn->getVariadic());
+		copy->setMember(fn->isMember());
+		copy->setTemplateInstance(fn->isTemplateInstance());
+		copy->setAsync(fn->isAsync());
+		copy->getTypeParams() = fn->getTypeParams();
+		result = copy;
+	}
+	else if(auto call = dynamic_cast<FunctionCall*>(expr))
+	{
+		auto copy = std::make_shared<FunctionCall>(call->getName(), call->isMethod());
+		cloneBody(call->getArgs(), copy->getArgs());
+		result = copy;
+	}
+	else if(auto binop = dynamic_cast<BinaryOp*>(expr))
+		result = std::make_shared<BinaryOp>(clone(binop->getLeft().get(), bindings), clone(binop->getRight().get(), bindings), binop->getOp());
+	else if(auto op = dynamic_cast<UnaryOp*>(expr))
+		result = std::make_shared<UnaryOp>(clone(op->getExp().get(), bindings), op->getOp());
+	else if(auto ret = dynamic_cast<Return*>(expr))
+		result = std::make_shared<Return>(clone(ret->getValue().get(), bindings), ret->isTail());
+	else if(auto yield = dynamic_cast<Yield*>(expr))
+		result = std::make_shared<Yield>(clone(yield->getValue().get(), bindings));
+	else if(auto await = dynamic_cast<Await*>(expr))
+		result = std::make_shared<Await>(clone(await->getValue().get(), bindings));
+	else if(auto var = dynamic_cast<Variable*>(expr))
+	{
+		// Type names passed as values, as in sizeof(T)
+		auto binding = bindings.find(var->getName());
+		const std::string name = (binding != bindings.end() ? binding->second : var->getName());
+
+		auto copy = std::make_shared<Variable>(name,
+											   std::static_pointer_cast<Variable>(clone(var->getField().get(), bindings)),
+											   clone(var->getIndex().get(), bindings));
+		copy->setFunctionCall(std::static_pointer_cast<FunctionCall>(clone(var->getFunctionCall().get(), bindings)));
+		result = copy;
+	}
+	else if(auto label = dynamic_cast<Label*>(expr))
+		result = std::make_shared<Label>(label->getName());
+	else if(auto jmp = dynamic_cast<Goto*>(expr))
+		result = std::make_shared<Goto>(jmp->getName());
+	else if(auto array = dynamic_cast<ArrayLiteral*>(expr))
+	{
+		auto copy = std::make_shared<ArrayLiteral>();
+		cloneBody(array->getValues(), copy->getValues());
+		result = copy;
+	}
+	else if(auto list = dynamic_cast<ValueList*>(expr))
+	{
+		auto copy = std::make_shared<ValueList>();
+		cloneBody(list->getValues(), copy->getValues());
+		result = copy;
+	}
+	else if(auto unpack = dynamic_cast<Unpack*>(expr))
+	{
+		auto copy = std::make_shared<Unpack>(unpack->isDeclaration());
+		cloneBody(unpack->getTargets(), copy->getTargets());
+		cloneBody(unpack->getValues(), copy->getValues());
+		result = copy;
+	}
+	else if(auto classdef = dynamic_cast<ClassDef*>(expr))
+	{
+		auto copy = std::make_shared<ClassDef>(classdef->getName());
+		cloneBody(classdef->getBody(), copy->getBody());
+		copy->getTypeParams() = classdef->getTypeParams();
+		result = copy;
+	}
+	else if(auto meta = dynamic_cast<Meta*>(expr))
+	{
+		std::vector<std::shared_ptr<Expr>> body;
+		cloneBody(meta->getBody(), body);
+		result = std::make_shared<Meta>(std::move(body));
+	}
+	else
+		return nullptr;
+
+	result->setLocation(expr->getLocation());
+	result->getAttributes() = expr->getAttributes();
+	return result;
+}
+
+static std::string escape(const std::string& str)
+{
+	std::string result;
+	for(char c : str)
+		switch(c)
+		{
+			case '\n': result += "\\n"; break;
+			case '\t': result += "\\t"; break;
+			case '\b': result += "\\b"; break;
+			case '"': result += "\\\""; break;
+			default: result += c;
+		}
+	return result;
+}
+
+// Exact, and always lexed as a Number even when it prints as an integer
+static std::string floatLiteral(float value)
+{
+	if(std::isnan(value))
+		return "(0.0 / 0.0)";
+	if(std::isinf(value))
+		return (value > 0 ? "(1.0 / 0.0)" : "(-1.0 / 0.0)");
+
+	char buffer[32];
+	snprintf(buffer, sizeof(buffer), "%.17g", value);
+
+	std::string result = buffer;
+	if(result.find('.') == std::string::npos)
+	{
+		size_t exponent = result.find('e');
+		result.insert(exponent == std::string::npos ? result.size() : exponent, ".0");
+	}
+	return result;
+}
+
+static std::string byteLiteral(char c)
+{
+	switch(c)
+	{
+		case '\n': return "'\\n'";
+		case '\t': return "'\\t'";
+		case '\b': return "'\\b'";
+		case '\0': return "'\\0'";
+		case '\\': return "'\\\\'";
+		case '\'': return "'\\''";
+	}
+
+	// Has no literal form
+	if(!isprint(static_cast<unsigned char>(c)))
+		return "<byte> (" + std::to_string(static_cast<int>(c)) + ")";
+
+	return std::string("'") + c + "'";
+}
+
+std::string Monomorphizer::toSource(Expr* expr, const std::string& indent)
+{
+	if(!expr)
+		return "";
+
+	std::stringstream ss;
+	auto body = [&ss, &indent](std::vector<std::shared_ptr<Expr>>& statements) {
+		for(auto& k : statements)
+			ss << indent << "\t" << toSource(k.get(), indent + "\t") << "\n";
+	};
+
+	auto typeList = [](std::vector<std::string>& params) {
+		std::string result = "<";
+		for(auto& p : params)
+			result += p + (p != params.back() ? ", " : "");
+		return result + ">";
+	};
+
+	// Types can end in '>' which must not merge with a following one into '>>'
+	auto type = [](const std::string& t) {
+		return (!t.empty() && t.back() == '>' ? t + " " : t);
+	};
+
+	if(auto cast = dynamic_cast<TypeCast*>(expr))
+		ss << "<" << type(cast->getType()) << "> (" << toSource(cast->getValue().get(), indent) << ")";
+	else if(auto v = dynamic_cast<Number*>(expr))
+		ss << floatLiteral(v->getValue());
+	else if(auto v = dynamic_cast<Integer*>(expr))
+		ss << v->getValue();
+	else if(auto v = dynamic_cast<Bool*>(expr))
+		ss << (v->getValue() ? "true" : "false");
+	else if(auto v = dynamic_cast<Byte*>(expr))
+		ss << byteLiteral(v->getValue());
+	else if(auto v = dynamic_cast<String*>(expr))
+		ss << "\"" << escape(v->getValue()) << "\"";
+	else if(auto iffi = dynamic_cast<If*>(expr))
+	{
+		ss << "if " << toSource(iffi->getHead().get(), indent) << " then\n";
+		body(iffi->getBody());
+		if(!iffi->getElse().empty())
+		{
+			ss << indent << "else\n";
+			body(iffi->getElse());
+		}
+		ss << indent << "end";
+	}
+	else if(auto whily = dynamic_cast<While*>(expr))
+	{
+		ss << whily->getAttributeString() << "while " << toSource(whily->getHead().get(), indent) << " do\n";
+		body(whily->getBody());
+		ss << indent << "end";
+	}
+	else if(auto fory = dynamic_cast<ParallelFor*>(expr))
+	{
+		auto init = static_cast<VariableDef*>(fory->getInit().get());
+		auto cond = static_cast<BinaryOp*>(fory->getCond().get());
+		ss << "parallel for " << init->getName() << " = " << toSource(init->getInitial().get(), indent)
+		   << ", " << toSource(cond->getRight().get(), indent);
+		if(fory->getGrain())
+			ss << ", " << toSource(fory->getGrain().get(), indent);
+
+		auto& reductions = fory->getReductions();
+		for(size_t i = 0; i < reductions.size(); i++)
+			ss << (i == 0 ? " reduce " : ", ") << reductions[i].first << " " << reductions[i].second;
+
+		ss << " do\n";
+		body(fory->getBody());
+		ss << indent << "end";
+	}
+	else if(auto fory = dynamic_cast<RangeFor*>(expr))
+	{
+		ss << fory->getAttributeString() << "for " << (fory->getIndex().empty() ? "" : fory->getIndex() + ", ") << fory->getValue()
+		   << " in " << toSource(fory->getRange().get(), indent) << " do\n";
+		body(fory->getBody());
+		ss << indent << "end";
+	}
+	else if(auto fory = dynamic_cast<For*>(expr))
+	{
+		auto init = static_cast<VariableDef*>(fory->getInit().get());
+		ss << fory->getAttributeString() << "for " << init->getName() << " = " << toSource(init->getInitial().get(), indent)
+		   << ", " << toSource(fory->getCond().get(), indent)
+		   << ", " << toSource(fory->getInc().get(), indent) << " do\n";
+		body(fory->getBody());
+		ss << indent << "end";
+	}
+	else if(auto var = dynamic_cast<VariableDef*>(expr))
+	{
+		ss << (var->getConst() ? "const " : "") << (var->getThreadLocal() ? "thread " : "") << (var->getExtern() ? "extern " : "") << "local " << var->getName();
+		if(var->getInitial())
+			ss << " = " << toSource(var->getInitial().get(), indent);
+		if(!var->getType().empty())
+			ss << " -> " << (var->getAtomic() ? "atomic " : "") << var->getType();
+		if(var->getSize() > 0)
+			ss << "[" << var->getSize() << "]";
+	}
+	else if(auto fn = dynamic_cast<Function*>(expr))
+	{
+		ss << fn->getAttributeString() << (fn->isAsync() ? "async " : "") << (fn->getExtern() ? "extern " : "") << "function " << fn->getName();
+		if(fn->isTemplate())
+			ss << typeList(fn->getTypeParams());
+
+		ss << "(";
+		auto& args = fn->getArgs();
+		for(auto& k : args)
+		{
+			auto arg = static_cast<VariableDef*>(k.get());
+			ss << type(arg->getType()) << " " << arg->getName() << (k != args.back() ? ", " : "");
+		}
+
+		if(fn->getVariadic())
+			ss << (args.empty() ? "..." : ", ...");
+
+		ss << ") -> " << fn->getResultTypes() << "\n";
+		if(!fn->getExtern())
+		{
+			body(fn->getBody());
+			ss << indent << "end";
+		}
+	}
+	else if(auto call = dynamic_cast<FunctionCall*>(expr))
+	{
+		auto& args = call->getArgs();
+		size_t i = 0;
+		if(call->isMethod())
+			ss << toSource(args[i++].get(), indent) << ":";
+
+		ss << call->getName() << "(";
+		for(; i < args.size(); i++)
+			ss << toSource(args[i].get(), indent) << (i != args.size() - 1 ? ", " : "");
+		ss << ")";
+	}
+	else if(auto binop = dynamic_cast<BinaryOp*>(expr))
+	{
+		if(binop->getOp() == "=")
+			ss << toSource(binop->getLeft().get(), indent) << " = " << toSource(binop->getRight().get(), indent);
+		else
+			ss << "(" << toSource(binop->getLeft().get(), indent) << " " << binop->getOp()
+			   << " " << toSource(binop->getRight().get(), indent) << ")";
+	}
+	else if(auto op = dynamic_cast<UnaryOp*>(expr))
+		ss << op->getOp() << "(" << toSource(op->getExp().get(), indent) << ")";
+	else if(auto ret = dynamic_cast<Return*>(expr))
+		ss << (ret->isTail() ? "return tail " : "return ") << toSource(ret->getValue().get(), indent);
+	else if(auto yield = dynamic_cast<Yield*>(expr))
+		ss << "yield " << (yield->getValue() ? toSource(yield->getValue().get(), indent) : "nil");
+	else if(auto await = dynamic_cast<Await*>(expr))
+		ss << "await " << toSource(await->getValue().get(), indent);
+	else if(auto var = dynamic_cast<Variable*>(expr))
+	{
+		ss << var->getName();
+		for(auto field = var->getField(); field; field = field->getField())
+			ss << "." << field->getName();
+
+		// The parser attaches an index to the head of the field chain
+		if(var->getIndex())
+			ss << "[" << toSource(var->getIndex().get(), indent) << "]";
+
+		if(var->getFunctionCall())
+			ss << "." << toSource(var->getFunctionCall().get(), indent);
+	}
+	else if(auto label = dynamic_cast<Label*>(expr))
+		ss << "::" << label->getName() << "::";
+	else if(auto jmp = dynamic_cast<Goto*>(expr))
+		ss << "goto " << jmp->getName();
+	else if(auto array = dynamic_cast<ArrayLiteral*>(expr))
+	{
+		ss << "{";
+		for(auto& k : array->getValues())
+			ss << toSource(k.get(), indent) << (k != array->getValues().back() ? ", " : "");
+		ss << "}";
+	}
+	else if(auto list = dynamic_cast<ValueList*>(expr))
+	{
+		for(auto& k : list->getValues())
+			ss << toSource(k.get(), indent) << (k != list->getValues().back() ? ", " : "");
+	}
+	else if(auto unpack = dynamic_cast<Unpack*>(expr))
+	{
+		ss << (unpack->isDeclaration() ? "local " : "");
+		for(auto& k : unpack->getTargets())
+			ss << toSource(k.get(), indent) << (k != unpack->getTargets().back() ? ", " : "");
+		ss << " = ";
+		for(auto& k : unpack->getValues())
+			ss << toSource(k.get(), indent) << (k != unpack->getValues().back() ? ", " : "");
+	}
+	else if(auto classdef = dynamic_cast<ClassDef*>(expr))
+	{
+		ss << "class " << classdef->getName();
+		if(classdef->isTemplate())
+			ss << typeList(classdef->getTypeParams());
+
+		ss << " {\n";
+		body(classdef->getBody());
+		ss << indent << "}";
+	}
+	else if(auto meta = dynamic_cast<Meta*>(expr))
+	{
+		ss << "meta\n";
+		body(meta->getBody());
+		ss << indent << "end";
+	}
+
+	return ss.str();
+}
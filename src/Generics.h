@@ -0,0 +1,51 @@
+#ifndef LUA_GENERICS_H
+#define LUA_GENERICS_H
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <unordered_map>
+#include <unordered_set>
+
+namespace AST { class Module; class Expr; class Function; class ClassDef; }
+
+// Instantiates generic classes and functions for concrete type arguments.
+// Instances are named after their full type, e.g. Vector<int>, so their
+// methods become Vector<int>_push like the methods of any other class.
+class Monomorphizer
+{
+public:
+	typedef std::unordered_map<std::string, std::string> Bindings;
+
+	Monomorphizer(AST::Module& module) : module(module) {}
+
+	// Inserts all class instances used by the module in front of their first user
+	void instantiateClasses();
+
+	// Creates all missing class instances expr depends on, dependencies first
+	void instantiateClasses(AST::Expr* expr, std::vector<std::shared_ptr<AST::ClassDef>>& result);
+
+	// Deduces the type arguments of a generic function from the argument types of a call
+	std::shared_ptr<AST::Function> instantiateFunction(AST::Function* function, const std::vector<std::string>& argTypes, AST::Expr* where);
+
+	static std::string substitute(const std::string& type, const Bindings& bindings);
+	static std::vector<std::string> splitTypeArgs(const std::string& args);
+	static std::shared_ptr<AST::Expr> clone(AST::Expr* expr, const Bindings& bindings);
+
+	// Templates are exported to modules as source so every user can instantiate them
+	static std::string toSource(AST::Expr* expr, const std::string& indent = "");
+
+private:
+	AST::Module& module;
+	std::unordered_set<std::string> ClassInstances;
+	std::unordered_map<std::string, std::shared_ptr<AST::Function>> FunctionInstances;
+
+	std::shared_ptr<AST::ClassDef> instantiateClass(const std::string& name, AST::Expr* where);
+	AST::ClassDef* findClassTemplate(const std::string& name);
+
+	static bool unify(const std::vector<std::string>& params, std::string param, std::string arg, Bindings& bindings);
+	static void collectTypes(AST::Expr* expr, std::vector<std::string>& types);
+	static void findGenericTypes(const std::string& type, std::vector<std::string>& result);
+};
+
+#endif //LUA_GENERICS_H
@@ -0,0 +1,682 @@
+#include "Interpreter.h"
+#include "AST.h"
+
+#include <climits>
+#include <cmath>
+#include <cstring>
+
+using namespace AST;
+
+std::string Interpreter::Value::getTypeName() const
+{
+	switch(Type)
+	{
+		case INT: return "int";
+		case FLOAT: return "float";
+		case BOOL: return "bool";
+		case BYTE: return "byte";
+		default: return "void";
+	}
+}
+
+std::string Interpreter::Value::getKey() const
+{
+	switch(Type)
+	{
+		case INT: return "i" + std::to_string(IntValue);
+		case BOOL: return BoolValue ? "b1" : "b0";
+		case BYTE: return "c" + std::to_string(int(ByteValue));
+		case FLOAT:
+		{
+			// Use the exact bit pattern, to_string rounds
+			uint32_t bits;
+			std::memcpy(&bits, &FloatValue, sizeof(bits));
+			return "f" + std::to_string(bits);
+		}
+		default: return "v";
+	}
+}
+
+bool Interpreter::isLiteral(Expr* expr)
+{
+	if(auto array = dynamic_cast<ArrayLiteral*>(expr))
+	{
+		for(auto& k : array->getValues())
+			if(!isLiteral(k.get()))
+				return false;
+		return true;
+	}
+
+	return dynamic_cast<Integer*>(expr) || dynamic_cast<Number*>(expr)
+		|| dynamic_cast<Bool*>(expr) || dynamic_cast<Byte*>(expr)
+		|| dynamic_cast<String*>(expr);
+}
+
+bool Interpreter::fromLiteral(Expr* expr, Value& result)
+{
+	if(auto v = dynamic_cast<Integer*>(expr))
+		result = Value::fromInt(v->getValue());
+	else if(auto v = dynamic_cast<Number*>(expr))
+		result = Value::fromFloat(v->getValue());
+	else if(auto v = dynamic_cast<Bool*>(expr))
+		result = Value::fromBool(v->getValue());
+	else if(auto v = dynamic_cast<Byte*>(expr))
+		result = Value::fromByte(v->getValue());
+	else
+		return false;
+
+	return true;
+}
+
+std::shared_ptr<Expr> Interpreter::toLiteral(const Value& value)
+{
+	switch(value.Type)
+	{
+		case Value::INT: return std::make_shared<Integer>(value.IntValue);
+		case Value::FLOAT: return std::make_shared<Number>(value.FloatValue);
+		case Value::BOOL: return std::make_shared<Bool>(value.BoolValue);
+		case Value::BYTE: return std::make_shared<Byte>(value.ByteValue);
+		default: return nullptr;
+	}
+}
+
+template<typename T>
+static bool compare(const std::string& op, T left, T right, bool& result)
+{
+	if(op == "<") result = left < right;
+	else if(op == ">") result = left > right;
+	else if(op == "<=") result = left <= right;
+	else if(op == ">=") result = left >= right;
+	else if(op == "==") result = left == right;
+	else if(op == "~=") result = (left < right || left > right); // Ordered like fcmp one
+	else return false;
+
+	return true;
+}
+
+bool Interpreter::evaluateBinary(const std::string& op, const Value& left, const Value& right, Value& result)
+{
+	if(left.Type != right.Type)
+		return false;
+
+	bool cmp;
+	switch(left.Type)
+	{
+		case Value::INT:
+		{
+			// Integers wrap around like the generated code does
+			const unsigned int a = left.IntValue, b = right.IntValue;
+			if(op == "+") result = Value::fromInt(int(a + b));
+			else if(op == "-") result = Value::fromInt(int(a - b));
+			else if(op == "*") result = Value::fromInt(int(a * b));
+			else if(op == "/")
+			{
+				if(right.IntValue == 0 || (left.IntValue == INT_MIN && right.IntValue == -1))
+					return false;
+				result = Value::fromInt(left.IntValue / right.IntValue);
+			}
+			else if(op == "%")
+			{
+				if(right.IntValue == 0 || (left.IntValue == INT_MIN && right.IntValue == -1))
+					return false;
+				result = Value::fromInt(left.IntValue % right.IntValue);
+			}
+			else if(op == "&") result = Value::fromInt(int(a & b));
+			else if(op == "|") result = Value::fromInt(int(a | b));
+			else if(op == "^") result = Value::fromInt(int(a ^ b));
+			else if(op == "<<" || op == ">>")
+			{
+				// Shifting by the width or more is poison in the generated code
+				if(b >= 32)
+					return false;
+				result = Value::fromInt(int(op == "<<" ? a << b : a >> b));
+			}
+			else if(compare(op, left.IntValue, right.IntValue, cmp)) result = Value::fromBool(cmp);
+			else return false;
+			return true;
+		}
+
+		case Value::FLOAT:
+			if(op == "+") result = Value::fromFloat(left.FloatValue + right.FloatValue);
+			else if(op == "-") result = Value::fromFloat(left.FloatValue - right.FloatValue);
+			else if(op == "*") result = Value::fromFloat(left.FloatValue * right.FloatValue);
+			else if(op == "/") result = Value::fromFloat(left.FloatValue / right.FloatValue);
+			else if(op == "%") result = Value::fromFloat(std::fmod(left.FloatValue, right.FloatValue));
+			else if(compare(op, left.FloatValue, right.FloatValue, cmp)) result = Value::fromBool(cmp);
+			else return false;
+			return true;
+
+		case Value::BYTE:
+			if(op == "+") result = Value::fromByte(char(left.ByteValue + right.ByteValue));
+			else if(op == "-") result = Value::fromByte(char(left.ByteValue - right.ByteValue));
+			else if(op == "*") result = Value::fromByte(char(left.ByteValue * right.ByteValue));
+			else if(compare(op, left.ByteValue, right.ByteValue, cmp)) result = Value::fromBool(cmp);
+			else return false;
+			return true;
+
+		case Value::BOOL:
+			if(op == "==") result = Value::fromBool(left.BoolValue == right.BoolValue);
+			else if(op == "~=") result = Value::fromBool(left.BoolValue != right.BoolValue);
+			else if(op == "&") result = Value::fromBool(left.BoolValue && right.BoolValue);
+			else if(op == "|") result = Value::fromBool(left.BoolValue || right.BoolValue);
+			else if(op == "^") result = Value::fromBool(left.BoolValue != right.BoolValue);
+			else return false;
+			return true;
+
+		default:
+			return false;
+	}
+}
+
+bool Interpreter::evaluateUnary(const std::string& op, const Value& operand, Value& result)
+{
+	if(op == "-" && operand.Type == Value::INT)
+		result = Value::fromInt(int(0u - (unsigned int) operand.IntValue));
+	else if(op == "-" && operand.Type == Value::FLOAT)
+		result = Value::fromFloat(-operand.FloatValue);
+	else if(op == "~" && operand.Type == Value::BOOL)
+		result = Value::fromBool(!operand.BoolValue);
+	else
+		return false;
+
+	return true;
+}
+
+void Interpreter::foldConstants()
+{
+	for(auto& k : module.getTopLevel())
+		foldConstants(k, true);
+}
+
+void Interpreter::foldConstants(std::shared_ptr<Expr>& expr, bool global)
+{
+	if(auto var = dynamic_cast<VariableDef*>(expr.get()))
+	{
+		auto initial = var->getInitial();
+		if(!initial)
+		{
+			if(var->getConst())
+				module.error("constant '" + var->getName() + "' needs an initial value", var->getLocation());
+			return;
+		}
+
+		// Only global initializers are required to be constant
+		if(isLiteral(initial.get()) || (!var->getConst() && (!global || var->getExtern())))
+			return;
+
+		auto folded = fold(initial, var->getSize());
+		if(folded)
+			var->setInitial(folded);
+		else if(var->getConst())
+			module.error("could not evaluate constant '" + var->getName() + "' at compile time: " + Error, (ErrorExpr ? ErrorExpr : initial.get())->getLocation());
+	}
+	else if(auto fn = dynamic_cast<Function*>(expr.get()))
+	{
+		for(auto& k : fn->getBody())
+			foldConstants(k, false);
+	}
+	else if(auto classdef = dynamic_cast<ClassDef*>(expr.get()))
+	{
+		for(auto& k : classdef->getBody())
+			foldConstants(k, false);
+	}
+	else if(auto iffi = dynamic_cast<If*>(expr.get()))
+	{
+		for(auto& k : iffi->getBody())
+			foldConstants(k, false);
+		for(auto& k : iffi->getElse())
+			foldConstants(k, false);
+	}
+	else if(auto whily = dynamic_cast<While*>(expr.get()))
+	{
+		for(auto& k : whily->getBody())
+			foldConstants(k, false);
+	}
+	else if(auto fory = dynamic_cast<For*>(expr.get()))
+	{
+		foldConstants(fory->getInit(), false);
+		for(auto& k : fory->getBody())
+			foldConstants(k, false);
+	}
+}
+
+std::shared_ptr<Expr> Interpreter::fold(const std::shared_ptr<Expr>& expr, unsigned int size)
+{
+	Error.clear();
+	ErrorExpr = nullptr;
+	Steps = 0;
+
+	if(size > 0)
+	{
+		auto array = std::make_shared<ArrayLiteral>();
+		array->setLocation(expr->getLocation());
+
+		if(auto values = dynamic_cast<ArrayLiteral*>(expr.get()))
+		{
+			for(auto& k : values->getValues())
+			{
+				auto value = fold(k);
+				if(!value)
+					return nullptr;
+				array->getValues().push_back(value);
+			}
+			return array;
+		}
+
+		// tabulate(fn) fills the array with fn(0) ... fn(size - 1)
+		auto generator = dynamic_cast<FunctionCall*>(expr.get());
+		if(!generator || generator->getName() != "tabulate")
+		{
+			fail("array initializers need to be an array literal or tabulate(function)");
+			return nullptr;
+		}
+
+		Variable* name = (generator->getArgs().size() == 1 ? dynamic_cast<Variable*>(generator->getArgs()[0].get()) : nullptr);
+		Function* fn = (name ? module.findFunction(name->getName()) : nullptr);
+		if(!fn)
+		{
+			fail("tabulate requires the name of a function as its only parameter");
+			return nullptr;
+		}
+
+		for(unsigned int i = 0; i < size; i++)
+		{
+			Value value;
+			if(!call(fn, { Value::fromInt(i) }, value))
+				return nullptr;
+
+			auto literal = toLiteral(value);
+			if(!literal)
+			{
+				fail("'" + fn->getName() + "' does not return a value");
+				return nullptr;
+			}
+
+			literal->setLocation(expr->getLocation());
+			array->getValues().push_back(literal);
+		}
+
+		return array;
+	}
+
+	Value value;
+	if(!evaluate(expr, value))
+		return nullptr;
+
+	auto literal = toLiteral(value);
+	if(!literal)
+	{
+		fail("expression does not have a value");
+		return nullptr;
+	}
+
+	literal->setLocation(expr->getLocation());
+	return literal;
+}
+
+bool Interpreter::evaluate(const std::shared_ptr<Expr>& expr, Value& result)
+{
+	CallStack.clear();
+	CallStack.emplace_back();
+
+	bool success = eval(expr.get(), result);
+	CallStack.clear();
+	return success;
+}
+
+Interpreter::Flow Interpreter::execute(std::vector<std::shared_ptr<Expr>>& body, Value& result)
+{
+	for(auto& k : body)
+	{
+		Flow flow = execute(k, result);
+		if(flow != NEXT)
+			return flow;
+	}
+
+	return NEXT;
+}
+
+Interpreter::Flow Interpreter::execute(const std::shared_ptr<Expr>& expr, Value& result)
+{
+	if(++Steps > MaxSteps)
+	{
+		fail("evaluation exceeded the maximum number of steps");
+		return FAILED;
+	}
+
+	if(auto ret = dynamic_cast<Return*>(expr.get()))
+	{
+		result = Value();
+		if(ret->getValue() && !eval(ret->getValue().get(), result))
+			return FAILED;
+		return RETURNED;
+	}
+
+	if(auto var = dynamic_cast<VariableDef*>(expr.get()))
+	{
+		if(var->getSize() > 0)
+		{
+			fail("arrays are not supported at compile time");
+			return FAILED;
+		}
+
+		Value value;
+		if(var->getInitial())
+		{
+			if(!eval(var->getInitial().get(), value))
+				return FAILED;
+		}
+		else if(var->getType() == "int") value = Value::fromInt(0);
+		else if(var->getType() == "float") value = Value::fromFloat(0);
+		else if(var->getType() == "bool") value = Value::fromBool(false);
+		else if(var->getType() == "byte") value = Value::fromByte(0);
+
+		if(!var->getType().empty() && !checkType(var->getType(), value))
+		{
+			fail("variable '" + var->getName() + "' has an unsupported type or mismatching initial value");
+			return FAILED;
+		}
+
+		CallStack.back()[var->getName()] = value;
+		return NEXT;
+	}
+
+	if(auto iffi = dynamic_cast<If*>(expr.get()))
+	{
+		Value condition;
+		if(!eval(iffi->getHead().get(), condition))
+			return FAILED;
+
+		if(condition.Type != Value::BOOL)
+		{
+			fail("condition is not a bool");
+			return FAILED;
+		}
+
+		return execute(condition.BoolValue ? iffi->getBody() : iffi->getElse(), result);
+	}
+
+	if(auto whily = dynamic_cast<While*>(expr.get()))
+	{
+		while(true)
+		{
+			Value condition;
+			if(!eval(whily->getHead().get(), condition))
+				return FAILED;
+
+			if(condition.Type != Value::BOOL)
+			{
+				fail("condition is not a bool");
+				return FAILED;
+			}
+
+			if(!condition.BoolValue)
+				return NEXT;
+
+			Flow flow = execute(whily->getBody(), result);
+			if(flow != NEXT)
+				return flow;
+		}
+	}
+
+	if(auto fory = dynamic_cast<For*>(expr.get()))
+	{
+		Flow flow = execute(fory->getInit(), result);
+		if(flow != NEXT)
+			return flow;
+
+		while(true)
+		{
+			Value condition;
+			if(!eval(fory->getCond().get(), condition))
+				return FAILED;
+
+			if(condition.Type != Value::BOOL)
+			{
+				fail("condition is not a bool");
+				return FAILED;
+			}
+
+			if(!condition.BoolValue)
+				return NEXT;
+
+			flow = execute(fory->getBody(), result);
+			if(flow != NEXT)
+				return flow;
+
+			Value dummy;
+			if(!eval(fory->getInc().get(), dummy))
+				return FAILED;
+		}
+	}
+
+	if(dynamic_cast<Label*>(expr.get()) || dynamic_cast<Goto*>(expr.get()))
+	{
+		fail("goto is not supported at compile time");
+		return FAILED;
+	}
+
+	Value dummy;
+	return eval(expr.get(), dummy) ? NEXT : FAILED;
+}
+
+bool Interpreter::eval(Expr* expr, Value& result)
+{
+	if(++Steps > MaxSteps)
+		return fail("evaluation exceeded the maximum number of steps");
+
+	if(fromLiteral(expr, result))
+		return true;
+
+	if(auto var = dynamic_cast<Variable*>(expr))
+	{
+		if(var->getIndex() || var->getField())
+			return fail("arrays and fields are not supported at compile time");
+
+		auto& frame = CallStack.back();
+		auto local = frame.find(var->getName());
+		if(local != frame.end())
+		{
+			result = local->second;
+			return true;
+		}
+
+		VariableDef* global = module.findGlobal(var->getName());
+		if(!global || !global->getConst() || !global->getInitial() || global->getSize() > 0)
+			return fail("'" + var->getName() + "' is not a constant");
+
+		if(EvaluatingGlobals.count(global->getName()))
+			return fail("constant '" + global->getName() + "' depends on itself");
+
+		EvaluatingGlobals.insert(global->getName());
+		CallStack.emplace_back();
+		bool success = eval(global->getInitial().get(), result);
+		CallStack.pop_back();
+		EvaluatingGlobals.erase(global->getName());
+
+		return success && checkType(global->getType().empty() ? result.getTypeName() : global->getType(), result);
+	}
+
+	if(auto binop = dynamic_cast<BinaryOp*>(expr))
+	{
+		if(binop->getOp() == "=")
+		{
+			auto target = dynamic_cast<Variable*>(binop->getLeft().get());
+			if(!target || target->getIndex() || target->getField())
+				return fail("can only assign to local variables at compile time");
+
+			return eval(binop->getRight().get(), result) && assign(target->getName(), result);
+		}
+
+		Value left, right;
+		if(!eval(binop->getLeft().get(), left) || !eval(binop->getRight().get(), right))
+			return false;
+
+		// Would trap in the generated code, so there is no value to fold to
+		if(left.Type == Value::INT && right.Type == Value::INT && (binop->getOp() == "/" || binop->getOp() == "%"))
+		{
+			if(right.IntValue == 0)
+				return fail("division by zero", binop);
+			if(left.IntValue == INT_MIN && right.IntValue == -1)
+				return fail("integer overflow in division", binop);
+		}
+
+		if(evaluateBinary(binop->getOp(), left, right, result))
+			return true;
+
+		// User defined operators are plain functions
+		Function* op = module.findFunction(module.getOperatorName(binop->getOp(), left.getTypeName(), right.getTypeName()));
+		if(op)
+			return call(op, { left, right }, result);
+
+		return fail("operator '" + binop->getOp() + "' can not be evaluated for '"
+					+ left.getTypeName() + "' and '" + right.getTypeName() + "'");
+	}
+
+	if(auto op = dynamic_cast<UnaryOp*>(expr))
+	{
+		Value operand;
+		if(!eval(op->getExp().get(), operand))
+			return false;
+
+		if(!evaluateUnary(op->getOp(), operand, result))
+			return fail("operator '" + op->getOp() + "' can not be evaluated for '" + operand.getTypeName() + "'");
+
+		return true;
+	}
+
+	if(auto cast = dynamic_cast<TypeCast*>(expr))
+	{
+		Value value;
+		if(!eval(cast->getValue().get(), value))
+			return false;
+
+		// Mirror the bit cast done by the code generator
+		const std::string& type = cast->getType();
+		if(type == value.getTypeName())
+			result = value;
+		else if(type == "int" && value.Type == Value::FLOAT)
+		{
+			result = Value::fromInt(0);
+			std::memcpy(&result.IntValue, &value.FloatValue, sizeof(int));
+		}
+		else if(type == "float" && value.Type == Value::INT)
+		{
+			result = Value::fromFloat(0);
+			std::memcpy(&result.FloatValue, &value.IntValue, sizeof(float));
+		}
+		else
+			return fail("can not cast '" + value.getTypeName() + "' to '" + type + "' at compile time");
+
+		return true;
+	}
+
+	if(auto fncall = dynamic_cast<FunctionCall*>(expr))
+	{
+		if(fncall->isMethod())
+			return fail("methods can not be called at compile time");
+
+		Function* fn = module.findFunction(fncall->getName());
+		if(!fn)
+			return fail("'" + fncall->getName() + "' can not be called at compile time");
+
+		std::vector<Value> args;
+		for(auto& k : fncall->getArgs())
+		{
+			Value value;
+			if(!eval(k.get(), value))
+				return false;
+			args.push_back(value);
+		}
+
+		return call(fn, args, result);
+	}
+
+	return fail("expression can not be evaluated at compile time");
+}
+
+bool Interpreter::call(Function* function, const std::vector<Value>& args, Value& result)
+{
+	if(function->getExtern())
+		return fail("extern function '" + function->getName() + "' can not be called at compile time");
+
+	if(function->getVariadic() || function->isMember() || function->isAsync())
+		return fail("'" + function->getName() + "' can not be called at compile time");
+
+	auto& params = function->getArgs();
+	if(params.size() != args.size())
+		return fail("argument count mismatch in call to '" + function->getName() + "'");
+
+	// Functions can not have side effects on anything but their locals,
+	// so every result can be reused. This keeps naive recursion linear.
+	std::string key = function->getName() + "(";
+	for(auto& v : args)
+		key += v.getKey() + ",";
+
+	auto cached = CallCache.find(key);
+	if(cached != CallCache.end())
+	{
+		result = cached->second;
+		return true;
+	}
+
+	if(CallStack.size() >= MaxCallDepth)
+		return fail("maximum call depth exceeded in '" + function->getName() + "'");
+
+	Frame frame;
+	for(size_t i = 0; i < params.size(); i++)
+	{
+		auto param = static_cast<VariableDef*>(params[i].get());
+		Value value = args[i];
+		if(!checkType(param->getType(), value))
+			return fail("argument type mismatch in call to '" + function->getName() + "'");
+
+		frame[param->getName()] = value;
+	}
+
+	CallStack.push_back(std::move(frame));
+
+	Value retval;
+	Flow flow = execute(function->getBody(), retval);
+	CallStack.pop_back();
+
+	if(flow == FAILED)
+		return false;
+
+	if(flow == NEXT)
+		retval = Value();
+
+	if(!checkType(function->getReturnType(), retval))
+		return fail("return type mismatch in '" + function->getName() + "'");
+
+	CallCache[key] = retval;
+	result = retval;
+	return true;
+}
+
+bool Interpreter::assign(const std::string& name, const Value& value)
+{
+	auto& frame = CallStack.back();
+	auto iter = frame.find(name);
+	if(iter == frame.end())
+		return fail("can only assign to local variables at compile time");
+
+	if(iter->second.Type != value.Type)
+		return fail("assignment to '" + name + "' expected '" + iter->second.getTypeName()
+					+ "' but got '" + value.getTypeName() + "'");
+
+	iter->second = value;
+	return true;
+}
+
+bool Interpreter::checkType(const std::string& type, Value& value)
+{
+	return value.getTypeName() == type;
+}
+
+bool Interpreter::fail(const std::string& message, AST::Expr* at)
+{
+	Error = message;
+	ErrorExpr = at;
+	return false;
+}
@@ -0,0 +1,87 @@
+#ifndef LUA_INTERPRETER_H
+#define LUA_INTERPRETER_H
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <unordered_map>
+#include <unordered_set>
+
+namespace AST { class Module; class Expr; class Function; class VariableDef; class SourceLocation; }
+
+// Evaluates ordinary functions over the typed AST at compile time.
+// Only scalar values are supported, everything else makes the evaluation fail
+// and leaves the expression to the code generator.
+class Interpreter
+{
+public:
+	struct Value
+	{
+		enum Kind { VOID, INT, FLOAT, BOOL, BYTE };
+
+		Kind Type = VOID;
+		union
+		{
+			int IntValue;
+			float FloatValue;
+			bool BoolValue;
+			char ByteValue;
+		};
+
+		Value() : IntValue(0) {}
+		static Value fromInt(int v) { Value r; r.Type = INT; r.IntValue = v; return r; }
+		static Value fromFloat(float v) { Value r; r.Type = FLOAT; r.FloatValue = v; return r; }
+		static Value fromBool(bool v) { Value r; r.Type = BOOL; r.BoolValue = v; return r; }
+		static Value fromByte(char v) { Value r; r.Type = BYTE; r.ByteValue = v; return r; }
+
+		std::string getTypeName() const;
+		std::string getKey() const;
+	};
+
+	Interpreter(AST::Module& module) : module(module) {}
+
+	// Replaces initializers of const variables and global variables by literals
+	void foldConstants();
+
+	// Returns a literal expression holding the value of expr or nullptr.
+	// Array sized variables may use tabulate(fn) to fill all 'size' elements.
+	std::shared_ptr<AST::Expr> fold(const std::shared_ptr<AST::Expr>& expr, unsigned int size = 0);
+	bool evaluate(const std::shared_ptr<AST::Expr>& expr, Value& result);
+
+	const std::string& getError() const { return Error; }
+
+	static bool isLiteral(AST::Expr* expr);
+	static bool fromLiteral(AST::Expr* expr, Value& result);
+	static std::shared_ptr<AST::Expr> toLiteral(const Value& value);
+
+	static bool evaluateBinary(const std::string& op, const Value& left, const Value& right, Value& result);
+	static bool evaluateUnary(const std::string& op, const Value& operand, Value& result);
+
+private:
+	enum Flow { NEXT, RETURNED, FAILED };
+	typedef std::unordered_map<std::string, Value> Frame;
+
+	AST::Module& module;
+	std::vector<Frame> CallStack;
+	std::unordered_map<std::string, Value> CallCache;
+	std::unordered_set<std::string> EvaluatingGlobals;
+	std::string Error;
+	AST::Expr* ErrorExpr = nullptr; // Where the evaluation failed, if known
+	size_t Steps = 0;
+
+	static const size_t MaxSteps = 50000000;
+	static const size_t MaxCallDepth = 512;
+
+	void foldConstants(std::shared_ptr<AST::Expr>& expr, bool global);
+
+	Flow execute(std::vector<std::shared_ptr<AST::Expr>>& body, Value& result);
+	Flow execute(const std::shared_ptr<AST::Expr>& expr, Value& result);
+	bool eval(AST::Expr* expr, Value& result);
+	bool call(AST::Function* function, const std::vector<Value>& args, Value& result);
+	bool assign(const std::string& name, const Value& value);
+	bool checkType(const std::string& type, Value& value);
+
+	bool fail(const std::string& message, AST::Expr* at = nullptr);
+};
+
+#endif //LUA_INTERPRETER_H
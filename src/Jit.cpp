@@ -0,0 +1,158 @@
+#include "Jit.h"
+
+#include <iostream>
+#include <llvm/ExecutionEngine/Orc/LLJIT.h>
+#include <llvm/ExecutionEngine/Orc/ExecutionUtils.h>
+#include <llvm/ExecutionEngine/Orc/JITTargetMachineBuilder.h>
+#include <llvm/IR/LegacyPassManager.h>
+#include <llvm/IR/Module.h>
+#include <llvm/IRReader/IRReader.h>
+#include <llvm/Analysis/TargetTransformInfo.h>
+#include <llvm/Support/SourceMgr.h>
+#include <llvm/Support/TargetSelect.h>
+#include <llvm/Target/TargetMachine.h>
+#include <llvm/Transforms/Coroutines.h>
+#include <llvm/Transforms/IPO.h>
+#include <llvm/Transforms/IPO/PassManagerBuilder.h>
+
+using namespace llvm;
+using namespace llvm::orc;
+
+static bool report(Error error)
+{
+	if(!error)
+		return true;
+
+	logAllUnhandledErrors(std::move(error), errs(), "JIT error: ");
+	return false;
+}
+
+Jit::Jit() = default;
+Jit::~Jit() = default;
+
+void Jit::optimize(Module& module, bool coroutines)
+{
+	legacy::PassManager modulePasses;
+	legacy::FunctionPassManager functionPasses(&module);
+	modulePasses.add(createTargetTransformInfoWrapperPass(Machine->getTargetIRAnalysis()));
+	functionPasses.add(createTargetTransformInfoWrapperPass(Machine->getTargetIRAnalysis()));
+
+	PassManagerBuilder builder;
+	builder.OptLevel = 3;
+	builder.SizeLevel = 0;
+	builder.Inliner = createFunctionInliningPass(3, 0, false);
+	builder.LoopVectorize = true;
+	builder.SLPVectorize = true;
+	Machine->adjustPassManager(builder);
+
+	// Same as 'opt -enable-coroutines'
+	if(coroutines)
+		addCoroutinePassesToExtensionPoints(builder);
+
+	builder.populateFunctionPassManager(functionPasses);
+	builder.populateModulePassManager(modulePasses);
+
+	functionPasses.doInitialization();
+	for(auto& function : module)
+		functionPasses.run(function);
+	functionPasses.doFinalization();
+	modulePasses.run(module);
+}
+
+bool Jit::start(std::unique_ptr<LLVMContext> context)
+{
+	InitializeNativeTarget();
+	InitializeNativeTargetAsmPrinter();
+	InitializeNativeTargetAsmParser();
+
+	auto targetBuilder = JITTargetMachineBuilder::detectHost();
+	if(!targetBuilder)
+		return report(targetBuilder.takeError());
+
+	// The JIT linker has no native TLS, thread locals go through __emutls_get_address
+	targetBuilder->getOptions().EmulatedTLS = true;
+	targetBuilder->getOptions().ExplicitEmulatedTLS = true;
+	targetBuilder->setCodeGenOptLevel(CodeGenOpt::Aggressive);
+
+	auto machine = targetBuilder->createTargetMachine();
+	if(!machine)
+		return report(machine.takeError());
+	Machine = std::move(*machine);
+
+	auto jit = LLJITBuilder().setJITTargetMachineBuilder(*targetBuilder).create();
+	if(!jit)
+		return report(jit.takeError());
+	Session = std::move(*jit);
+
+	// libc, libpthread and friends come from the compiler process
+	auto process = DynamicLibrarySearchGenerator::GetForCurrentProcess(Session->getDataLayout().getGlobalPrefix());
+	if(!process)
+		return report(process.takeError());
+	Session->getMainJITDylib().addGenerator(std::move(*process));
+
+	Context = std::make_unique<ThreadSafeContext>(std::move(context));
+	return true;
+}
+
+bool Jit::addModule(std::unique_ptr<Module> module, bool coroutines)
+{
+	module->setDataLayout(Session->getDataLayout());
+	optimize(*module, coroutines);
+	return report(Session->addIRModule(ThreadSafeModule(std::move(module), *Context)));
+}
+
+// Required modules were optimized when they were compiled
+bool Jit::addLibrary(const std::string& path)
+{
+	auto context = std::make_unique<LLVMContext>();
+	SMDiagnostic diagnostic;
+	std::unique_ptr<Module> library = parseIRFile(path, diagnostic, *context);
+	if(!library)
+	{
+		diagnostic.print("l++", errs());
+		return false;
+	}
+
+	library->setDataLayout(Session->getDataLayout());
+	return report(Session->addIRModule(ThreadSafeModule(std::move(library), std::move(context))));
+}
+
+void* Jit::lookup(const std::string& name)
+{
+	auto symbol = Session->lookup(name);
+	if(!symbol)
+	{
+		report(symbol.takeError());
+		return nullptr;
+	}
+
+	return reinterpret_cast<void*>(symbol->getAddress());
+}
+
+int Jit::run(std::unique_ptr<Module> module, std::unique_ptr<LLVMContext> context,
+			 const std::vector<std::string>& libraries, const std::vector<std::string>& args, bool coroutines)
+{
+	if(!start(std::move(context)) || !addModule(std::move(module), coroutines))
+		return 1;
+
+	for(auto& path : libraries)
+		if(!addLibrary(path))
+			return 1;
+
+	if(!report(Session->initialize(Session->getMainJITDylib())))
+		return 1;
+
+	auto main = reinterpret_cast<int (*)(int, char**)>(lookup("main"));
+	if(!main)
+		return 1;
+
+	std::vector<char*> argv;
+	for(auto& arg : args)
+		argv.push_back(const_cast<char*>(arg.c_str()));
+	argv.push_back(nullptr);
+
+	int result = main(static_cast<int>(args.size()), argv.data());
+	if(!report(Session->deinitialize(Session->getMainJITDylib())))
+		return 1;
+	return result;
+}
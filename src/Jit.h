@@ -0,0 +1,45 @@
+#ifndef LUA_JIT_H
+#define LUA_JIT_H
+
+#include <string>
+#include <vector>
+#include <memory>
+
+namespace llvm
+{
+	class Module;
+	class LLVMContext;
+	class TargetMachine;
+	namespace orc { class LLJIT; class ThreadSafeContext; }
+}
+
+// Runs programs without writing any files: modules are optimized like
+// 'opt -O3' would and executed by ORC LLJIT together with the .ll files of the
+// required modules. Everything else is looked up in the compiler process.
+// All modules given to one Jit share its context and see each other's symbols.
+class Jit
+{
+public:
+	Jit();
+	~Jit();
+
+	// Takes over the context all later modules are created in
+	bool start(std::unique_ptr<llvm::LLVMContext> context);
+
+	bool addModule(std::unique_ptr<llvm::Module> module, bool coroutines);
+	bool addLibrary(const std::string& path);
+	void* lookup(const std::string& name);
+
+	// Returns what main returned or 1 when the program could not be started
+	int run(std::unique_ptr<llvm::Module> module, std::unique_ptr<llvm::LLVMContext> context,
+			const std::vector<std::string>& libraries, const std::vector<std::string>& args, bool coroutines);
+
+private:
+	void optimize(llvm::Module& module, bool coroutines);
+
+	std::unique_ptr<llvm::orc::LLJIT> Session;
+	std::unique_ptr<llvm::TargetMachine> Machine;
+	std::unique_ptr<llvm::orc::ThreadSafeContext> Context;
+};
+
+#endif //LUA_JIT_H
@@ -1,5 +1,18 @@
 #include <lua.hpp>
+#ifdef LPP_LUAJIT
+#include <luajit.h>
+#endif
+#include <cstdlib>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <algorithm>
+#include <vector>
+#include <sys/stat.h>
+#include <unistd.h>
 #include "MetaContext.h"
+#include "MetaModule.h"
 #include "AST.h"
 
 using namespace AST;
@@ -9,11 +22,160 @@ extern "C"
 int luaopen_AST(lua_State*);
 }
 
+// FNV-1a, stable between runs unlike std::hash
+static uint64_t hashSource(const std::string& source)
+{
+	uint64_t hash = 14695981039346656037ull ^ LUA_VERSION_NUM;
+#ifdef LUAJIT_VERSION_NUM
+	hash ^= static_cast<uint64_t>(LUAJIT_VERSION_NUM) << 32; // Its bytecode differs from the one of Lua 5.1
+#endif
+	for(unsigned char c : source)
+	{
+		hash ^= c;
+		hash *= 1099511628211ull;
+	}
+	return hash;
+}
+
+static int writeChunk(lua_State*, const void* data, size_t size, void* bytecode)
+{
+	static_cast<std::string*>(bytecode)->append(static_cast<const char*>(data), size);
+	return 0;
+}
+
+// LPP_META_CACHE overrides the directory, an empty value turns the cache off
+static std::string getCacheDirectory()
+{
+	if(const char* directory = getenv("LPP_META_CACHE"))
+		return directory;
+
+	std::string base;
+	if(const char* cache = getenv("XDG_CACHE_HOME"))
+		base = cache;
+	else if(const char* home = getenv("HOME"))
+		base = std::string(home) + "/.cache";
+	else
+		return "";
+
+	mkdir(base.c_str(), 0755);
+	return base + "/l++";
+}
+
+#ifdef LPP_LUAJIT
+// Called with the table of the bindings. AST.entries() and AST.children(entry)
+// return snapshots holding arrays of structs, their fields are read by compiled
+// traces directly.
+static const char* FfiPrelude = R"(
+local AST = ...
+local ffi = require("ffi")
+ffi.cdef[[
+struct lpp_meta_node;
+struct lpp_meta_entry { int kind; unsigned int size; const char* name; const char* type; const struct lpp_meta_node* node; };
+struct lpp_meta_snapshot { unsigned int count; const struct lpp_meta_entry* entries; };
+const struct lpp_meta_snapshot* lpp_meta_top_level(void);
+const struct lpp_meta_snapshot* lpp_meta_children(const struct lpp_meta_node* node);
+void lpp_meta_release(const struct lpp_meta_snapshot* snapshot);
+]]
+
+AST.kinds = { [0] = "expression", "function", "class", "variable", "meta" }
+
+-- Entries are snapshot.entries[0] to snapshot.entries[snapshot.count - 1]. They stay
+-- valid as long as the snapshot is referenced, changes of the tree do not show up.
+function AST.entries()
+	return ffi.gc(ffi.C.lpp_meta_top_level(), ffi.C.lpp_meta_release)
+end
+
+-- Statements of functions, members of classes and blocks of meta
+function AST.children(entry)
+	return ffi.gc(ffi.C.lpp_meta_children(entry.node), ffi.C.lpp_meta_release)
+end
+)";
+#endif
+
+// Instructions run between two checks of the limits
+static const int HookInterval = 1000;
+
+// Errors may be any value, not only strings
+static std::string getError(lua_State* L)
+{
+	const char* message = lua_tostring(L, -1);
+	return (message ? message : "error object is not a string");
+}
+
+void* MetaContext::allocate(void* context, void* block, size_t oldSize, size_t newSize)
+{
+	auto self = static_cast<MetaContext*>(context);
+
+	// Without a block oldSize is the type of the new object
+	if(!block)
+		oldSize = 0;
+
+	if(newSize == 0)
+	{
+		free(block);
+		self->MemoryUsed -= oldSize;
+		return nullptr;
+	}
+
+	// Only growing may fail, Lua expects shrinking to succeed
+	if(newSize > oldSize && self->Running)
+	{
+		// Globals of earlier blocks and cached chunks stay, only the growth counts
+		if(self->MemoryLimit && self->MemoryUsed - oldSize + newSize > self->MemoryBase + self->MemoryLimit)
+		{
+			self->MemoryExceeded = true;
+			return nullptr;
+		}
+
+		self->Current.allocations++;
+		self->Current.bytes += newSize - oldSize;
+	}
+
+	void* result = realloc(block, newSize);
+	if(result)
+		self->MemoryUsed = self->MemoryUsed - oldSize + newSize;
+	return result;
+}
+
+void MetaContext::countInstructions(lua_State* L, lua_Debug*)
+{
+	// The user data of the allocator is not ours when the state fell back to luaL_newstate
+	auto self = &shared();
+
+	self->Current.instructions += HookInterval;
+	if(self->InstructionLimit && self->Current.instructions > self->InstructionLimit)
+		luaL_error(L, "exceeded the limit of %llu instructions", static_cast<unsigned long long>(self->InstructionLimit));
+
+	if(self->HasDeadline && std::chrono::steady_clock::now() > self->Deadline)
+		luaL_error(L, "exceeded the time limit");
+}
+
 MetaContext::MetaContext()
 {
+#ifdef LPP_LUAJIT
+	// LuaJIT on 64 bit refuses custom allocators and complains on stderr, so there is no memory limit
 	L = luaL_newstate();
+#else
+	L = lua_newstate(allocate, this);
+	TrackingMemory = (L != nullptr);
+	if(!L)
+		L = luaL_newstate();
+#endif
+
 	luaL_openlibs(L);
 	luaopen_AST(L);
+
+#ifdef LPP_LUAJIT
+	if(luaL_loadstring(L, FfiPrelude) != 0 || (lua_pushvalue(L, -2), lua_pcall(L, 1, 0, 0)) != 0)
+	{
+		std::cerr << "Could not set up the FFI bindings: " << getError(L) << std::endl;
+		lua_pop(L, 1);
+	}
+#endif
+
+	CacheDirectory = getCacheDirectory();
+	if(!CacheDirectory.empty())
+		mkdir(CacheDirectory.c_str(), 0755);
 }
 
 MetaContext::~MetaContext()
@@ -21,10 +183,146 @@ MetaContext::~MetaContext()
 	lua_close(L);
 }
 
+MetaContext& MetaContext::shared()
+{
+	static MetaContext context;
+	return context;
+}
+
+// Pushes the chunk compiled from source or the error message
+bool MetaContext::load(const std::string& source, uint64_t hash)
+{
+	auto known = Chunks.find(hash);
+	if(known != Chunks.end())
+	{
+		lua_rawgeti(L, LUA_REGISTRYINDEX, known->second);
+		return true;
+	}
+
+	char name[32];
+	snprintf(name, sizeof(name), "/%016llx.luac", static_cast<unsigned long long>(hash));
+	std::string path = (CacheDirectory.empty() ? "" : CacheDirectory + name);
+
+	// Bytecode of another Lua version fails to load and is replaced
+	bool loaded = false;
+	std::ifstream in;
+	if(!path.empty())
+		in.open(path, std::ios::binary);
+
+	if(in)
+	{
+		std::string bytecode((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+#if LUA_VERSION_NUM >= 502
+		loaded = (luaL_loadbufferx(L, bytecode.data(), bytecode.size(), "=meta", "b") == 0);
+#else
+		loaded = (luaL_loadbuffer(L, bytecode.data(), bytecode.size(), "=meta") == 0);
+#endif
+		if(!loaded)
+			lua_pop(L, 1);
+	}
+
+	if(!loaded)
+	{
+		if(luaL_loadbuffer(L, source.data(), source.size(), "=meta") != 0)
+			return false;
+
+		std::string bytecode;
+#if LUA_VERSION_NUM >= 503
+		bool dumped = (lua_dump(L, writeChunk, &bytecode, 0) == 0);
+#else
+		bool dumped = (lua_dump(L, writeChunk, &bytecode) == 0);
+#endif
+
+		// Concurrent compilers only ever see complete files
+		if(dumped && !path.empty())
+		{
+			std::string temporary = path + "." + std::to_string(getpid());
+			std::ofstream out(temporary, std::ios::binary);
+			bool written = static_cast<bool>(out.write(bytecode.data(), bytecode.size()));
+			out.close();
+			if(!written || rename(temporary.c_str(), path.c_str()) != 0)
+				remove(temporary.c_str());
+		}
+	}
+
+	lua_pushvalue(L, -1);
+	Chunks[hash] = luaL_ref(L, LUA_REGISTRYINDEX);
+	return true;
+}
+
 void MetaContext::apply(AST::Module& module, AST::Meta* meta)
-{ std::cout << meta->toLua() << std::endl;
-	if(luaL_dostring(L, meta->toLua().c_str()) != 0)
+{
+	std::string source = meta->toLua();
+	AST::CompilationFlags flags = module.getFlags();
+	if(!load(source, hashSource(source)))
+	{
+		module.error("Could not apply meta block: " + getError(L), meta->getLocation());
+		lua_pop(L, 1);
+		return;
+	}
+
+	InstructionLimit = flags.metaInstructions;
+	HasDeadline = (flags.metaMilliseconds > 0);
+	MemoryLimit = (TrackingMemory ? flags.metaMemory : 0);
+	MemoryExceeded = false;
+	MemoryBase = MemoryUsed;
+	Current = Profile();
+
+	// The hook costs time, blocks without limits only run it when profiling
+	if(InstructionLimit || HasDeadline || flags.metaProfile)
+		lua_sethook(L, countInstructions, LUA_MASKCOUNT, HookInterval);
+
+#ifdef LPP_LUAJIT
+	// Compiled traces never call the hook, limited and profiled blocks are interpreted
+	bool hooked = (InstructionLimit || HasDeadline || flags.metaProfile);
+	luaJIT_setmode(L, 0, LUAJIT_MODE_ENGINE | (hooked ? LUAJIT_MODE_OFF : LUAJIT_MODE_ON));
+#endif
+
+	// AST.getModule() hands the block the tree it is part of
+	MetaModule::setCurrent(&module, meta);
+	auto start = std::chrono::steady_clock::now();
+	Deadline = start + std::chrono::milliseconds(flags.metaMilliseconds);
+	Running = true;
+
+	bool failed = (lua_pcall(L, 0, 0, 0) != 0);
+
+	Running = false;
+	Current.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	MetaModule::setCurrent(nullptr, nullptr);
+	lua_sethook(L, nullptr, 0, 0);
+
+	if(failed)
+	{
+		std::string message = (MemoryExceeded ? "exceeded the limit of " + std::to_string(MemoryLimit) + " bytes of memory" : getError(L));
+		module.error("Could not apply meta block: " + message, meta->getLocation());
+		lua_pop(L, 1);
+	}
+
+	if(flags.metaProfile)
+	{
+		auto location = meta->getLocation();
+		auto& profile = Profiles[module.getSourceName() + ":" + std::to_string(location.getLine()) + ":" + std::to_string(location.getCol())];
+		profile.runs++;
+		profile.seconds += Current.seconds;
+		profile.instructions += Current.instructions;
+		profile.allocations += Current.allocations;
+		profile.bytes += Current.bytes;
+	}
+}
+
+void MetaContext::report(std::ostream& out) const
+{
+	if(Profiles.empty())
+		return;
+
+	std::vector<std::pair<std::string, Profile>> sorted(Profiles.begin(), Profiles.end());
+	std::sort(sorted.begin(), sorted.end(), [](const auto& a, const auto& b) { return a.second.seconds > b.second.seconds; });
+
+	out << "Meta blocks: location, runs, milliseconds, instructions, allocations, allocated bytes" << std::endl;
+	for(auto& entry : sorted)
 	{
-		module.error(std::string("Could not apply meta block: ") + lua_tostring(L, -1), meta->getLocation());
+		auto& profile = entry.second;
+		out << entry.first << "\t" << profile.runs << "\t" << profile.seconds * 1000.0 << "\t" << profile.instructions
+			<< "\t" << profile.allocations << "\t" << profile.bytes << std::endl;
 	}
 }
@@ -2,16 +2,66 @@
 #define LUA_METACONTEXT_H
 
 #include <lua.hpp>
+#include <string>
+#include <cstdint>
+#include <chrono>
+#include <map>
+#include <ostream>
+#include <unordered_map>
 
 namespace AST { class Module; class Meta; }
+
+// One Lua state runs the meta blocks of every module of a compilation.
+// Compiled chunks are kept by the hash of their source, in the registry and as
+// bytecode in the cache directory, so unchanged meta blocks are parsed once.
+//
+// Blocks run with the instruction, time and memory limits of the compilation.
+// A count hook checks the first two, the allocator of the state the last one.
 class MetaContext
 {
+	struct Profile
+	{
+		unsigned int runs = 0;
+		double seconds = 0;
+		uint64_t instructions = 0; // Counted in steps of the hook interval
+		uint64_t allocations = 0;
+		uint64_t bytes = 0;
+	};
+
 	lua_State* L;
-public:
+	std::unordered_map<uint64_t, int> Chunks; // Registry references of the loaded chunks
+	std::string CacheDirectory; // Empty when bytecode is not written to disk
+
+	// State of the running block, read by the hook and the allocator
+	bool Running = false;
+	bool TrackingMemory = false; // False if the state does not use our allocator
+	uint64_t InstructionLimit = 0;
+	std::chrono::steady_clock::time_point Deadline;
+	bool HasDeadline = false;
+	size_t MemoryLimit = 0;
+	bool MemoryExceeded = false;
+	size_t MemoryUsed = 0;
+	size_t MemoryBase = 0; // MemoryUsed when the block started
+	Profile Current;
+
+	std::map<std::string, Profile> Profiles; // By location of the block
+
 	MetaContext();
+	bool load(const std::string& source, uint64_t hash);
+
+	static void* allocate(void* context, void* block, size_t oldSize, size_t newSize);
+	static void countInstructions(lua_State* L, lua_Debug* debug);
+
+public:
+	MetaContext(const MetaContext&) = delete;
+	MetaContext& operator=(const MetaContext&) = delete;
 	~MetaContext();
 
+	static MetaContext& shared();
 	void apply(AST::Module& module, AST::Meta* meta);
+
+	// Slowest blocks first
+	void report(std::ostream& out) const;
 };
 
 #endif //LUA_METACONTEXT_H
@@ -0,0 +1,282 @@
+#include "MetaModule.h"
+#include "AST.h"
+#include <deque>
+
+using namespace AST;
+
+static MetaModule current;
+
+MetaModule getModule()
+{
+	return current;
+}
+
+void MetaModule::setCurrent(AST::Module* module, AST::Meta* block)
+{
+	current = MetaModule(module, block);
+}
+
+// Children of the node, nullptr for nodes without a body
+static std::vector<std::shared_ptr<Expr>>* getBody(Expr* node)
+{
+	if(auto function = dynamic_cast<Function*>(node))
+		return &function->getBody();
+	else if(auto classdef = dynamic_cast<ClassDef*>(node))
+		return &classdef->getBody();
+	else if(auto meta = dynamic_cast<Meta*>(node))
+		return &meta->getBody();
+	return nullptr;
+}
+
+static const char* KindNames[] = { "expression", "function", "class", "variable", "meta" };
+
+static int getKind(Expr* node)
+{
+	if(dynamic_cast<Function*>(node))
+		return 1;
+	else if(dynamic_cast<ClassDef*>(node))
+		return 2;
+	else if(dynamic_cast<VariableDef*>(node))
+		return 3;
+	else if(dynamic_cast<Meta*>(node))
+		return 4;
+	return 0;
+}
+
+std::string MetaNode::kind() const
+{
+	return KindNames[getKind(Node.get())];
+}
+
+std::string MetaNode::getName() const
+{
+	if(auto function = dynamic_cast<Function*>(Node.get()))
+		return function->getName();
+	else if(auto classdef = dynamic_cast<ClassDef*>(Node.get()))
+		return classdef->getName();
+	else if(auto var = dynamic_cast<VariableDef*>(Node.get()))
+		return var->getName();
+	else if(auto var = dynamic_cast<Variable*>(Node.get()))
+		return var->getName();
+	else if(auto call = dynamic_cast<FunctionCall*>(Node.get()))
+		return call->getName();
+	return "";
+}
+
+std::string MetaNode::getType() const
+{
+	if(auto function = dynamic_cast<Function*>(Node.get()))
+		return function->getReturnType();
+	return (Node ? Node->getType() : "");
+}
+
+std::string MetaNode::toSource() const
+{
+	return (Node ? Monomorphizer::toSource(Node.get()) : "");
+}
+
+unsigned int MetaNode::size() const
+{
+	auto body = getBody(Node.get());
+	return (body ? body->size() : 0);
+}
+
+MetaNode MetaNode::at(unsigned int idx) const
+{
+	auto body = getBody(Node.get());
+	if(!body || idx >= body->size())
+		return MetaNode();
+	return MetaNode((*body)[idx]);
+}
+
+void MetaNode::append(const MetaNode& node)
+{
+	auto body = getBody(Node.get());
+	if(body && node.Node)
+		body->push_back(node.Node);
+}
+
+void MetaNode::addParameter(const std::string& type, const std::string& name)
+{
+	if(auto function = dynamic_cast<Function*>(Node.get()))
+	{
+		auto param = std::make_shared<VariableDef>(name, type, nullptr);
+		param->setLocation(function->getLocation());
+		function->getArgs().push_back(param);
+	}
+}
+
+void MetaNode::addArgument(const MetaNode& node)
+{
+	if(auto call = dynamic_cast<FunctionCall*>(Node.get()))
+		if(node.Node)
+			call->getArgs().push_back(node.Node);
+}
+
+void MetaNode::addAttribute(const std::string& attribute)
+{
+	if(Node)
+		Node->getAttributes().push_back(attribute);
+}
+
+void MetaNode::setInitial(const MetaNode& node)
+{
+	if(auto var = dynamic_cast<VariableDef*>(Node.get()))
+		var->setInitial(node.Node);
+}
+
+unsigned int MetaModule::size() const
+{
+	return (Module ? Module->getTopLevel().size() : 0);
+}
+
+MetaNode MetaModule::at(unsigned int idx) const
+{
+	if(idx >= size())
+		return MetaNode();
+	return MetaNode(Module->getTopLevel()[idx]);
+}
+
+MetaNode MetaModule::find(const std::string& name) const
+{
+	for(unsigned int i = 0; i < size(); i++)
+	{
+		MetaNode node(Module->getTopLevel()[i]);
+		if(node.kind() != "expression" && node.getName() == name)
+			return node;
+	}
+	return MetaNode();
+}
+
+void MetaModule::append(const MetaNode& node)
+{
+	if(Module && !node.isNull())
+		Module->getTopLevel().push_back(node.get());
+}
+
+void MetaModule::insert(unsigned int idx, const MetaNode& node)
+{
+	if(!Module || node.isNull())
+		return;
+
+	auto& topLevel = Module->getTopLevel();
+	topLevel.insert(topLevel.begin() + std::min<size_t>(idx, topLevel.size()), node.get());
+}
+
+void MetaModule::remove(unsigned int idx)
+{
+	if(idx < size())
+		Module->getTopLevel().erase(Module->getTopLevel().begin() + idx);
+}
+
+// Errors in generated code point at the meta block that created it
+template<typename T, typename... Args>
+static MetaNode create(AST::Meta* block, Args&&... args)
+{
+	auto node = std::make_shared<T>(std::forward<Args>(args)...);
+	if(block)
+		node->setLocation(block->getLocation());
+	return MetaNode(node);
+}
+
+MetaNode MetaModule::newFunction(const std::string& name, const std::string& returnType) const
+{
+	return create<Function>(Block, name, returnType);
+}
+
+MetaNode MetaModule::newClass(const std::string& name) const
+{
+	return create<ClassDef>(Block, name);
+}
+
+MetaNode MetaModule::newVariable(const std::string& name, const std::string& type, unsigned int size) const
+{
+	return create<VariableDef>(Block, name, type, nullptr, size);
+}
+
+MetaNode MetaModule::newInteger(int value) const
+{
+	return create<Integer>(Block, value);
+}
+
+MetaNode MetaModule::newNumber(float value) const
+{
+	return create<Number>(Block, value);
+}
+
+MetaNode MetaModule::newBoolean(bool value) const
+{
+	return create<Bool>(Block, value);
+}
+
+MetaNode MetaModule::newString(const std::string& value) const
+{
+	return create<String>(Block, value);
+}
+
+MetaNode MetaModule::newReference(const std::string& name) const
+{
+	return create<Variable>(Block, name, nullptr);
+}
+
+MetaNode MetaModule::newBinary(const std::string& op, const MetaNode& left, const MetaNode& right) const
+{
+	return create<BinaryOp>(Block, left.get(), right.get(), op);
+}
+
+MetaNode MetaModule::newCall(const std::string& name) const
+{
+	return create<FunctionCall>(Block, name);
+}
+
+MetaNode MetaModule::newReturn(const MetaNode& value) const
+{
+	return create<Return>(Block, value.get());
+}
+
+// Storage of one snapshot, the view handed out is its base
+struct Snapshot : lpp_meta_snapshot
+{
+	std::vector<lpp_meta_entry> Entries;
+	std::vector<std::shared_ptr<Expr>> Nodes;
+	std::deque<std::string> Strings; // Does not move its elements when growing
+};
+
+static const lpp_meta_snapshot* takeSnapshot(const std::vector<std::shared_ptr<Expr>>& nodes)
+{
+	auto snapshot = new Snapshot;
+	snapshot->Nodes = nodes;
+	for(auto& node : nodes)
+	{
+		MetaNode handle(node);
+		snapshot->Strings.push_back(handle.getName());
+		const char* name = snapshot->Strings.back().c_str();
+		snapshot->Strings.push_back(handle.getType());
+		const char* type = snapshot->Strings.back().c_str();
+		snapshot->Entries.push_back({ getKind(node.get()), handle.size(), name, type, reinterpret_cast<const lpp_meta_node*>(node.get()) });
+	}
+
+	snapshot->count = snapshot->Entries.size();
+	snapshot->entries = snapshot->Entries.data();
+	return snapshot;
+}
+
+const struct lpp_meta_snapshot* lpp_meta_top_level(void)
+{
+	std::vector<std::shared_ptr<Expr>> nodes;
+	MetaModule module = getModule();
+	for(unsigned int i = 0; i < module.size(); i++)
+		nodes.push_back(module.at(i).get());
+	return takeSnapshot(nodes);
+}
+
+const struct lpp_meta_snapshot* lpp_meta_children(const struct lpp_meta_node* node)
+{
+	auto body = getBody(const_cast<Expr*>(reinterpret_cast<const Expr*>(node)));
+	return takeSnapshot(body ? *body : std::vector<std::shared_ptr<Expr>>());
+}
+
+void lpp_meta_release(const struct lpp_meta_snapshot* snapshot)
+{
+	delete static_cast<const Snapshot*>(snapshot);
+}
@@ -0,0 +1,110 @@
+#ifndef LUA_METAMODULE_H
+#define LUA_METAMODULE_H
+
+#include <memory>
+#include <string>
+
+namespace AST { class Expr; class Module; class Meta; }
+
+// Handle of an AST node for meta blocks. Handles share the node with the tree,
+// so changes made through them are visible to the compiler without a reparse.
+class MetaNode
+{
+	std::shared_ptr<AST::Expr> Node;
+
+public:
+	MetaNode() = default;
+#ifndef SWIG
+	MetaNode(const std::shared_ptr<AST::Expr>& node) : Node(node) {}
+	const std::shared_ptr<AST::Expr>& get() const { return Node; }
+#endif
+
+	bool isNull() const { return Node == nullptr; }
+
+	// "function", "class", "variable", "meta" or "expression"
+	std::string kind() const;
+	std::string getName() const;
+	std::string getType() const;
+	std::string toSource() const;
+
+	// Statements of functions, members of classes and blocks of meta
+	unsigned int size() const;
+	MetaNode at(unsigned int idx) const;
+	void append(const MetaNode& node);
+
+	void addParameter(const std::string& type, const std::string& name);
+	void addArgument(const MetaNode& node);
+	void addAttribute(const std::string& attribute);
+	void setInitial(const MetaNode& node);
+};
+
+// Top level of the module whose meta block is running. Created nodes carry the
+// location of that meta block and are compiled like parsed ones once spliced in.
+class MetaModule
+{
+	AST::Module* Module;
+	AST::Meta* Block;
+
+public:
+	MetaModule(AST::Module* module = nullptr, AST::Meta* block = nullptr) : Module(module), Block(block) {}
+
+	unsigned int size() const;
+	MetaNode at(unsigned int idx) const;
+	MetaNode find(const std::string& name) const;
+
+	void append(const MetaNode& node);
+	void insert(unsigned int idx, const MetaNode& node);
+	void remove(unsigned int idx);
+
+	MetaNode newFunction(const std::string& name, const std::string& returnType) const;
+	MetaNode newClass(const std::string& name) const;
+	MetaNode newVariable(const std::string& name, const std::string& type, unsigned int size = 0) const;
+	MetaNode newInteger(int value) const;
+	MetaNode newNumber(float value) const;
+	MetaNode newBoolean(bool value) const;
+	MetaNode newString(const std::string& value) const;
+	MetaNode newReference(const std::string& name) const;
+	MetaNode newBinary(const std::string& op, const MetaNode& left, const MetaNode& right) const;
+	MetaNode newCall(const std::string& name) const;
+	MetaNode newReturn(const MetaNode& value) const;
+
+#ifndef SWIG
+	static void setCurrent(AST::Module* module, AST::Meta* block);
+#endif
+};
+
+// Module of the meta block being applied
+MetaModule getModule();
+
+#ifndef SWIG
+// Plain views of the tree for LuaJIT's FFI, declared again in its cdef.
+// Reading fields needs no call into the bindings. Every snapshot owns its
+// entries and keeps their nodes alive until it is released, later changes
+// of the tree do not show up in it. Creating and splicing nodes stays with
+// the bindings above.
+extern "C"
+{
+struct lpp_meta_node; // An AST::Expr
+
+struct lpp_meta_entry
+{
+	int kind; // Index into "expression", "function", "class", "variable", "meta"
+	unsigned int size; // Number of children
+	const char* name;
+	const char* type;
+	const struct lpp_meta_node* node; // Handle for lpp_meta_children
+};
+
+struct lpp_meta_snapshot
+{
+	unsigned int count;
+	const struct lpp_meta_entry* entries;
+};
+
+const struct lpp_meta_snapshot* lpp_meta_top_level(void);
+const struct lpp_meta_snapshot* lpp_meta_children(const struct lpp_meta_node* node);
+void lpp_meta_release(const struct lpp_meta_snapshot* snapshot);
+}
+#endif
+
+#endif //LUA_METAMODULE_H
@@ -11,8 +11,68 @@ void SemanticChecker::matchTypes(AST::Module& module, AST::Expr* a, AST::Expr* b
 	}
 }
 
+// Calls fn for every statement in body, including the ones in nested blocks
+template<typename Fn>
+static void forEachStatement(std::vector<std::shared_ptr<AST::Expr>>& body, Fn&& fn)
+{
+	for(auto& k : body)
+	{
+		fn(k.get());
+
+		if(auto iffi = dynamic_cast<AST::If*>(k.get()))
+		{
+			forEachStatement(iffi->getBody(), fn);
+			forEachStatement(iffi->getElse(), fn);
+		}
+		else if(auto whily = dynamic_cast<AST::While*>(k.get()))
+			forEachStatement(whily->getBody(), fn);
+		else if(auto fory = dynamic_cast<AST::For*>(k.get()))
+			forEachStatement(fory->getBody(), fn);
+		else if(auto fory = dynamic_cast<AST::RangeFor*>(k.get()))
+			forEachStatement(fory->getBody(), fn);
+	}
+}
+
+// The body of a parallel for becomes a function of its own, control can not leave it
+static void checkParallelFor(AST::Module& module, AST::ParallelFor* fory)
+{
+	std::unordered_set<std::string> labels;
+	forEachStatement(fory->getBody(), [&labels](AST::Expr* expr) {
+		if(auto label = dynamic_cast<AST::Label*>(expr))
+			labels.insert(label->getName());
+	});
+
+	forEachStatement(fory->getBody(), [&module, &labels](AST::Expr* expr) {
+		if(dynamic_cast<AST::Return*>(expr))
+			module.error("return is not allowed in the body of a parallel for", expr->getLocation());
+		else if(auto jmp = dynamic_cast<AST::Goto*>(expr))
+		{
+			if(!labels.count(jmp->getName()))
+				module.error("goto can not leave the body of a parallel for", expr->getLocation());
+		}
+	});
+}
+
+static void checkParallelFors(AST::Module& module, AST::Function* fn)
+{
+	forEachStatement(fn->getBody(), [&module](AST::Expr* expr) {
+		if(auto fory = dynamic_cast<AST::ParallelFor*>(expr))
+			checkParallelFor(module, fory);
+	});
+}
+
 void SemanticChecker::check(AST::Module& module)
 {
+	for(auto& k : module.getTopLevel())
+	{
+		if(auto fn = dynamic_cast<AST::Function*>(k.get()))
+			checkParallelFors(module, fn);
+		else if(auto classdef = dynamic_cast<AST::ClassDef*>(k.get()))
+			for(auto& member : classdef->getBody())
+				if(auto method = dynamic_cast<AST::Function*>(member.get()))
+					checkParallelFors(module, method);
+	}
+
 	module.visit([&module](AST::Expr* expr) {
 		if(auto fn = dynamic_cast<AST::Function*>(expr))
 		{
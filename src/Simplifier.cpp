@@ -0,0 +1,185 @@
+#include "Simplifier.h"
+#include "Interpreter.h"
+#include "AST.h"
+
+using namespace AST;
+
+void Simplifier::simplify(Module& module)
+{
+	for(auto& k : module.getTopLevel())
+		simplify(k);
+}
+
+bool Simplifier::getCondition(Expr* expr, bool& value)
+{
+	auto b = dynamic_cast<Bool*>(expr);
+	if(!b)
+		return false;
+
+	value = b->getValue();
+	return true;
+}
+
+void Simplifier::simplifyBody(std::vector<std::shared_ptr<Expr>>& body)
+{
+	std::vector<std::shared_ptr<Expr>> result;
+	bool reachable = true;
+
+	for(auto& k : body)
+	{
+		// Labels can be jumped to, everything else after a return or goto is dead
+		if(!reachable && !dynamic_cast<Label*>(k.get()))
+			continue;
+
+		reachable = true;
+		simplify(k);
+
+		bool condition;
+		if(auto iffi = dynamic_cast<If*>(k.get()))
+		{
+			if(getCondition(iffi->getHead().get(), condition))
+			{
+				// Variables declared in branches live in the enclosing scope anyway
+				auto& taken = (condition ? iffi->getBody() : iffi->getElse());
+				result.insert(result.end(), taken.begin(), taken.end());
+
+				if(!result.empty() && (dynamic_cast<Return*>(result.back().get()) || dynamic_cast<Goto*>(result.back().get())))
+					reachable = false;
+				continue;
+			}
+		}
+		else if(auto whily = dynamic_cast<While*>(k.get()))
+		{
+			if(getCondition(whily->getHead().get(), condition) && !condition)
+				continue;
+		}
+
+		result.push_back(k);
+		if(dynamic_cast<Return*>(k.get()) || dynamic_cast<Goto*>(k.get()))
+			reachable = false;
+	}
+
+	body = std::move(result);
+}
+
+void Simplifier::simplify(std::shared_ptr<Expr>& expr)
+{
+	if(!expr)
+		return;
+
+	if(auto binop = dynamic_cast<BinaryOp*>(expr.get()))
+	{
+		simplify(binop->getRight());
+
+		// The left side of an assignment has to stay a variable
+		if(binop->getOp() == "=")
+			return;
+
+		simplify(binop->getLeft());
+
+		Interpreter::Value left, right, result;
+		if(Interpreter::fromLiteral(binop->getLeft().get(), left)
+			&& Interpreter::fromLiteral(binop->getRight().get(), right)
+			&& Interpreter::evaluateBinary(binop->getOp(), left, right, result))
+		{
+			auto literal = Interpreter::toLiteral(result);
+			literal->setLocation(expr->getLocation());
+			expr = literal;
+		}
+	}
+	else if(auto op = dynamic_cast<UnaryOp*>(expr.get()))
+	{
+		simplify(op->getExp());
+
+		Interpreter::Value operand, result;
+		if(Interpreter::fromLiteral(op->getExp().get(), operand)
+			&& Interpreter::evaluateUnary(op->getOp(), operand, result))
+		{
+			auto literal = Interpreter::toLiteral(result);
+			literal->setLocation(expr->getLocation());
+			expr = literal;
+		}
+	}
+	else if(auto cast = dynamic_cast<TypeCast*>(expr.get()))
+	{
+		auto value = cast->getValue();
+		simplify(value);
+		cast->setValue(value);
+	}
+	else if(auto call = dynamic_cast<FunctionCall*>(expr.get()))
+	{
+		for(auto& k : call->getArgs())
+			simplify(k);
+	}
+	else if(auto var = dynamic_cast<Variable*>(expr.get()))
+	{
+		auto index = var->getIndex();
+		simplify(index);
+		var->setIndex(index);
+	}
+	else if(auto ret = dynamic_cast<Return*>(expr.get()))
+	{
+		simplify(ret->getValue());
+	}
+	else if(auto yield = dynamic_cast<Yield*>(expr.get()))
+	{
+		simplify(yield->getValue());
+	}
+	else if(auto await = dynamic_cast<Await*>(expr.get()))
+	{
+		simplify(await->getValue());
+	}
+	else if(auto var = dynamic_cast<VariableDef*>(expr.get()))
+	{
+		simplify(var->getInitial());
+	}
+	else if(auto array = dynamic_cast<ArrayLiteral*>(expr.get()))
+	{
+		for(auto& k : array->getValues())
+			simplify(k);
+	}
+	else if(auto list = dynamic_cast<ValueList*>(expr.get()))
+	{
+		for(auto& k : list->getValues())
+			simplify(k);
+	}
+	else if(auto unpack = dynamic_cast<Unpack*>(expr.get()))
+	{
+		for(auto& k : unpack->getValues())
+			simplify(k);
+	}
+	else if(auto iffi = dynamic_cast<If*>(expr.get()))
+	{
+		simplify(iffi->getHead());
+		simplifyBody(iffi->getBody());
+		simplifyBody(iffi->getElse());
+	}
+	else if(auto whily = dynamic_cast<While*>(expr.get()))
+	{
+		simplify(whily->getHead());
+		simplifyBody(whily->getBody());
+	}
+	else if(auto fory = dynamic_cast<RangeFor*>(expr.get()))
+	{
+		simplify(fory->getRange());
+		simplifyBody(fory->getBody());
+	}
+	else if(auto fory = dynamic_cast<For*>(expr.get()))
+	{
+		simplify(fory->getInit());
+		simplify(fory->getCond());
+		simplify(fory->getInc());
+		if(auto parallel = dynamic_cast<ParallelFor*>(fory))
+			simplify(parallel->getGrain());
+		simplifyBody(fory->getBody());
+	}
+	else if(auto fn = dynamic_cast<Function*>(expr.get()))
+	{
+		simplifyBody(fn->getBody());
+	}
+	else if(auto classdef = dynamic_cast<ClassDef*>(expr.get()))
+	{
+		for(auto& k : classdef->getMethods())
+			simplifyBody(k->getBody());
+	}
+}
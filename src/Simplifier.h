@@ -0,0 +1,22 @@
+#ifndef LUA_SIMPLIFIER_H
+#define LUA_SIMPLIFIER_H
+
+#include <vector>
+#include <memory>
+
+namespace AST { class Module; class Expr; }
+
+// Folds constant expressions, removes branches with constant conditions and
+// drops statements that can never be reached before any IR is emitted.
+class Simplifier
+{
+public:
+	void simplify(AST::Module& module);
+
+private:
+	void simplifyBody(std::vector<std::shared_ptr<AST::Expr>>& body);
+	void simplify(std::shared_ptr<AST::Expr>& expr);
+	bool getCondition(AST::Expr* expr, bool& value);
+};
+
+#endif //LUA_SIMPLIFIER_H
@@ -14,8 +14,15 @@ static std::string type2str(llvm::Type* type)
 
 	if(llvm::isa<llvm::StructType>(type))
 	{
-		std::string name = static_cast<llvm::StructType*>(type)->getName().str();
-		return prefix + name;
+		auto structure = static_cast<llvm::StructType*>(type);
+		if(!structure->isLiteral())
+			return prefix + structure->getName().str();
+
+		// Results of a function returning several values
+		std::string fields;
+		for(auto* field : structure->elements())
+			fields += (fields.empty() ? "" : ",") + type2str(field);
+		return prefix + "(" + fields + ")";
 	}
 
 	if(type->isIntegerTy(32))
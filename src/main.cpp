@@ -7,6 +7,7 @@
 
 int parse();
 int parse(FILE *fp, const AST::CompilationFlags& flags);
+int repl(const AST::CompilationFlags& flags);
 
 int main(int argc, char** argv)
 {
@@ -17,8 +18,22 @@ int main(int argc, char** argv)
 	if(argc < 2)
 		return 0;
 	
+	static const option longOptions[] = {
+		{"cpu", required_argument, nullptr, 'c'},
+		{"features", required_argument, nullptr, 'F'},
+		{"run", no_argument, nullptr, 'r'},
+		{"repl", no_argument, nullptr, 'R'},
+		{"meta-instructions", required_argument, nullptr, 'i'},
+		{"meta-time", required_argument, nullptr, 't'},
+		{"meta-memory", required_argument, nullptr, 'M'},
+		{"meta-profile", no_argument, nullptr, 'P'},
+		{nullptr, 0, nullptr, 0}
+	};
+
+	// --run ends the options, the rest belongs to the program even if it starts with '-'.
+	// A leading '+' keeps GNU getopt from moving those arguments in front.
 	int opt;
-	while((opt = getopt(argc, argv, "mvhs:o:I:")) != -1)
+	while(!flags.run && (opt = getopt_long(argc, argv, "+mvhs:o:I:f:", longOptions, nullptr)) != -1)
 	{
 		switch (opt)
 			{
@@ -47,12 +62,65 @@ int main(int argc, char** argv)
 		case 'I':
 				flags.includePath = optarg;
 		break;
+
+		// -ffast-math lets every function reassociate and contract float math
+		case 'f':
+				if(std::string(optarg) != "fast-math")
+				{
+					std::cerr << "Unknown option -f" << optarg << std::endl;
+					exit(EXIT_FAILURE);
+				}
+				flags.fastMath = true;
+		break;
+
+		case 'c':
+				flags.targetCpu = optarg;
+		break;
+
+		case 'F':
+				flags.targetFeatures = optarg;
+		break;
+
+		case 'r':
+				flags.run = true;
+		break;
+
+		case 'R':
+				flags.repl = true;
+		break;
+
+		// Limits of every meta block: instructions, milliseconds and MiB of Lua heap
+		case 'i':
+				flags.metaInstructions = strtoull(optarg, nullptr, 10);
+		break;
+
+		case 't':
+				flags.metaMilliseconds = strtoul(optarg, nullptr, 10);
+		break;
+
+		case 'M':
+				flags.metaMemory = strtoull(optarg, nullptr, 10) << 20;
+		break;
+
+		case 'P':
+				flags.metaProfile = true;
+		break;
 		default:
 				//usage(argv[0]);
 				exit(EXIT_FAILURE);
 		}
 	}
 	
+	// A '--' right after --run is only a separator
+	if(flags.run && optind < argc && std::string(argv[optind]) == "--")
+		optind++;
+
+	for(int i = optind; i < argc; i++)
+		flags.runArguments.push_back(argv[i]);
+
+	if(flags.repl)
+		return repl(flags);
+
 	FILE* file = fopen(flags.input.c_str(), "r");
 	if(!file)
 	{
@@ -60,7 +128,10 @@ int main(int argc, char** argv)
 		return 1;
 	}
 	
-	parse(file, flags);
-	return 0;
+	int result = parse(file, flags);
+	if(flags.metaProfile)
+		MetaContext::shared().report(std::cerr);
+
+	return (flags.run ? result : 0);
 }
 
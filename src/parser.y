@@ -24,6 +24,7 @@ extern char *yytext;
 
 #include <AST.h>
 #include <SemanticChecker.h>
+#include <Jit.h>
 
 #include <llvm/IR/LLVMContext.h>
 #include <llvm/IR/Module.h>
@@ -39,12 +40,38 @@ AST::SourceLocation makeSourceLoc(YYLTYPE* l)
 	return loc;
 }
 
+// Every elseif nests in the else of the previous one
+AST::If* lastElseif(AST::Expr* expr)
+{
+	auto iffi = static_cast<AST::If*>(expr);
+	AST::If* next;
+	while(iffi->getElse().size() == 1 && (next = dynamic_cast<AST::If*>(iffi->getElse()[0].get())))
+		iffi = next;
+	return iffi;
+}
+
+// 'atomic' is parsed in front of the type of a variable and moved to the variable
+ExprList* applyQualifiers(ExprList* list)
+{
+	for(auto& k : *list)
+	{
+		auto var = dynamic_cast<AST::VariableDef*>(k.get());
+		if(var && var->getType().compare(0, 7, "atomic ") == 0)
+		{
+			var->setType(var->getType().substr(7));
+			var->setAtomic(true);
+		}
+	}
+	return list;
+}
+
 std::shared_ptr<AST::Module> ast = std::make_shared<AST::Module>();
 
 %}
 
 %union{
 	std::string* sval;
+	std::vector<std::string>* slist;
 	FunctionBody* functionBody;
 	ExprList* exprList;
 	float fval;
@@ -79,10 +106,21 @@ std::shared_ptr<AST::Module> ast = std::make_shared<AST::Module>();
 %token Elseif "elseif"
 %token Nil
 %token Return "return"
+%token Tail "tail"
+%token In "in"
+%token Restrict "restrict"
 %token ArrowRight "->"
 %token ArrowLeft "<-"
 %token For "for"
+%token Parallel "parallel"
+%token Reduce "reduce"
 %token Extern "extern"
+%token Const "const"
+%token Thread "thread"
+%token Async "async"
+%token Await "await"
+%token Yield "yield"
+%token Atomic "atomic"
 %token OperatorDef "operator"
 
 %token EQ "=="
@@ -91,6 +129,7 @@ std::shared_ptr<AST::Module> ast = std::make_shared<AST::Module>();
 %token LEQ "<="
 
 %token ThreeDot "..."
+%token AttributeBegin "[["
 
 %token Class "class"
 %token Meta "meta"
@@ -113,16 +152,32 @@ std::shared_ptr<AST::Module> ast = std::make_shared<AST::Module>();
 %type <exprList> variabledef
 %type <sval> pointermarklist
 %type <sval> pointermark
+%type <slist> attributes
+%type <slist> attributelist
+%type <sval> attribute
+%type <slist> namelist
+%type <sval> typename
+%type <sval> vartype
+%type <sval> paramtype
+%type <sval> typelist
+%type <sval> resulttype
+%type <sval> opname
+%type <expr> grainsize
+%type <slist> reductions
+%type <slist> reductionlist
+%type <sval> reduceop
 
 %nonassoc Then
 %nonassoc Elseif
 %nonassoc Else
 
+// Lower than any operator, so 'return' and 'yield' take the whole expression
+%nonassoc Yield Tail
 %left Operator
 %left '<' '>' '=' EQ NEQ GEQ LEQ
 %left '+' '-'
 %left '*' '/'
-%right '$' '@'
+%right '$' '@' Await
 
 %%
 
@@ -159,6 +214,20 @@ stat:
 					delete $2;
 					delete $4;
 				}
+		|		Class Name '<' namelist '>' '{' block '}'
+				{
+					$$ = new ExprList;
+					auto classdef = std::make_shared<AST::ClassDef>(*$2);
+					for(auto& k : *$7)
+						classdef->getBody().push_back(k);
+
+					classdef->getTypeParams() = std::move(*$4);
+					classdef->setLocation(makeSourceLoc(&@1));
+					$$->push_back(classdef);
+					delete $2;
+					delete $4;
+					delete $7;
+				}
 		| varlist Operator explist
 		{
 			$$ = new ExprList;
@@ -177,6 +246,19 @@ stat:
 			delete $2;
 			delete $3;
 		}
+		| varlist ',' var '=' explist
+		{
+			$$ = new ExprList;
+			auto unpack = std::make_shared<AST::Unpack>(false);
+			unpack->getTargets() = std::move(*$1);
+			unpack->getTargets().push_back(std::shared_ptr<AST::Expr>($3));
+			unpack->getValues() = std::move(*$5);
+			unpack->setLocation(makeSourceLoc(&@4));
+
+			$$->push_back(unpack);
+			delete $1;
+			delete $5;
+		}
 		| 		exp { $$ = new ExprList; $$->push_back(std::shared_ptr<AST::Expr>($1)); }
 		|		label { $$ = new ExprList; $$->push_back(std::make_shared<AST::Label>(*$1)); delete $1;}
 		//|		Break
@@ -203,7 +285,60 @@ stat:
 			delete $2;
 			delete $10;
 		}
-				
+
+		| 		For Name In exp Do block End
+		{
+			$$ = new ExprList;
+			auto fory = std::make_shared<AST::RangeFor>("", *$2, std::shared_ptr<AST::Expr>($4));
+			fory->setLocation(makeSourceLoc(&@1));
+			fory->getBody() = std::move(*$6);
+			$$->push_back(fory);
+
+			delete $2;
+			delete $6;
+		}
+
+		| 		For Name ',' Name In exp Do block End
+		{
+			$$ = new ExprList;
+			auto fory = std::make_shared<AST::RangeFor>(*$2, *$4, std::shared_ptr<AST::Expr>($6));
+			fory->setLocation(makeSourceLoc(&@1));
+			fory->getBody() = std::move(*$8);
+			$$->push_back(fory);
+
+			delete $2;
+			delete $4;
+			delete $8;
+		}
+
+		| 		Parallel For Name '=' exp ',' exp grainsize reductions Do block End
+		{
+			$$ = new ExprList;
+
+			// Iterates over [first, last) just like 'for i = first, i < last, i = i + 1'
+			auto var = [&]() { return std::make_shared<AST::Variable>(*$3, nullptr); };
+			auto vardef = std::make_shared<AST::VariableDef>(*$3, "", std::shared_ptr<AST::Expr>($5));
+			auto cond = std::make_shared<AST::BinaryOp>(var(), std::shared_ptr<AST::Expr>($7), "<");
+			auto inc = std::make_shared<AST::BinaryOp>(var(), std::make_shared<AST::BinaryOp>(var(), std::make_shared<AST::Integer>(1), "+"), "=");
+			auto fory = std::make_shared<AST::ParallelFor>(vardef, cond, inc, std::shared_ptr<AST::Expr>($8));
+
+			fory->setLocation(makeSourceLoc(&@1));
+			vardef->setLocation(makeSourceLoc(&@4));
+			cond->setLocation(makeSourceLoc(&@7));
+
+			for(size_t i = 0; i < $9->size(); i += 2)
+				fory->getReductions().push_back({(*$9)[i], (*$9)[i + 1]});
+
+			for(auto& k : *$11)
+				fory->getBody().push_back(k);
+
+			$$->push_back(fory);
+
+			delete $3;
+			delete $9;
+			delete $11;
+		}
+
 		| 		While exp Do block End
 				{
 					$$ = new ExprList;
@@ -280,8 +415,28 @@ stat:
 					delete $2;
 					delete $3;
 				}
+		|		Function funcname '<' namelist '>' funcbody
+				{
+					$$ = new ExprList;
+					std::shared_ptr<AST::Function> function;
+					$$->push_back(function = std::make_shared<AST::Function>(*$2, $6->Type));
+					function->setLocation(makeSourceLoc(&@1));
+					
+					for(auto& k : *$6->Body)
+						function->getBody().push_back(k);
+					
+					for(auto& k : *$6->Args)
+						function->getArgs().push_back(k);
+					
+					function->setVariadic($6->IsVariadic);
+					function->getTypeParams() = std::move(*$4);
+					
+					delete $2;
+					delete $4;
+					delete $6;
+				}
 
-		|		OperatorDef pointermark Name Name Operator pointermark Name Name ArrowRight pointermark Name block End
+		|		OperatorDef pointermark typename Name opname pointermark typename Name ArrowRight pointermark typename block End
 				{
 					$$ = new ExprList;
 					std::shared_ptr<AST::Function> function;
@@ -309,11 +464,11 @@ stat:
 					delete $12;
 				}
 				
-		| Extern Function funcname '(' parlist ')' ArrowRight pointermark Name
+		| Extern Function funcname '(' parlist ')' ArrowRight resulttype
 		{
 			$$ = new ExprList;
 			std::shared_ptr<AST::Function> function;
-			$$->push_back(function = std::make_shared<AST::Function>(*$3, *$8 + *$9, true));
+			$$->push_back(function = std::make_shared<AST::Function>(*$3, *$8, true));
 			function->setLocation(makeSourceLoc(&@1));
 
 			for(auto& k : *$5)
@@ -321,15 +476,14 @@ stat:
 					
 			delete $3;
 			delete $8;
-			delete $9;
 			delete $5;
 		}
 		
-		| Extern Function funcname '(' parlist ',' ThreeDot ')' ArrowRight pointermark Name
+		| Extern Function funcname '(' parlist ',' ThreeDot ')' ArrowRight resulttype
 		{
 			$$ = new ExprList;
 			std::shared_ptr<AST::Function> function;
-			$$->push_back(function = std::make_shared<AST::Function>(*$3, *$10 + *$11, true));
+			$$->push_back(function = std::make_shared<AST::Function>(*$3, *$10, true));
 			function->setLocation(makeSourceLoc(&@1));
 
 			for(auto& k : *$5)
@@ -339,39 +493,101 @@ stat:
 			
 			delete $3;
 			delete $10;
-			delete $11;
 			delete $5;
 		}
 		
-		| Extern Function funcname '(' ThreeDot ')' ArrowRight pointermark Name
+		| Extern Function funcname '(' ThreeDot ')' ArrowRight resulttype
 		{
 			$$ = new ExprList;
 			std::shared_ptr<AST::Function> function;
-			$$->push_back(function = std::make_shared<AST::Function>(*$3, *$8 + *$9, true));
+			$$->push_back(function = std::make_shared<AST::Function>(*$3, *$8, true));
 			function->setLocation(makeSourceLoc(&@1));
 
 			function->setVariadic(true);
 			
 			delete $3;
 			delete $8;
-			delete $9;
 		}
 				
 		//|       	Local Function funcname funcbody
 		//|		Local namelist
-		| variabledef { $$ = $1; }
+		| variabledef { $$ = applyQualifiers($1); }
+		| Const variabledef
+		{
+			$$ = applyQualifiers($2);
+			for(auto& k : *$$)
+			{
+				if(auto var = dynamic_cast<AST::VariableDef*>(k.get()))
+					var->setConst(true);
+				else
+					ast->error("constants need one value each", makeSourceLoc(&@1));
+			}
+		}
+		| Thread variabledef
+		{
+			$$ = applyQualifiers($2);
+			for(auto& k : *$$)
+			{
+				if(auto var = dynamic_cast<AST::VariableDef*>(k.get()))
+					var->setThreadLocal(true);
+				else
+					ast->error("thread local variables need one value each", makeSourceLoc(&@1));
+			}
+		}
 		| Return exp
 		{
 			$$ = new ExprList;
 			$$->push_back(std::make_shared<AST::Return>(std::shared_ptr<AST::Expr>($2)));
 		}
+		| Return exp ',' explist
+		{
+			$$ = new ExprList;
+			auto list = std::make_shared<AST::ValueList>();
+			list->getValues().push_back(std::shared_ptr<AST::Expr>($2));
+			list->getValues().insert(list->getValues().end(), $4->begin(), $4->end());
+			list->setLocation(makeSourceLoc(&@2));
+
+			$$->push_back(std::make_shared<AST::Return>(list));
+			$$->back()->setLocation(makeSourceLoc(&@1));
+			delete $4;
+		}
 
-		| Return
+		| Return %prec Yield
 		{
 			$$ = new ExprList;
 			$$->push_back(std::make_shared<AST::Return>(nullptr));
 			$$->back()->setLocation(makeSourceLoc(&@1));
 		}
+		| Return Tail exp
+		{
+			$$ = new ExprList;
+			$$->push_back(std::make_shared<AST::Return>(std::shared_ptr<AST::Expr>($3), true));
+			$$->back()->setLocation(makeSourceLoc(&@1));
+		}
+		| Yield exp
+		{
+			$$ = new ExprList;
+			$$->push_back(std::make_shared<AST::Yield>(std::shared_ptr<AST::Expr>($2)));
+			$$->back()->setLocation(makeSourceLoc(&@1));
+		}
+		| Yield Nil // Spelled out, a bare yield would swallow the next statement
+		{
+			$$ = new ExprList;
+			$$->push_back(std::make_shared<AST::Yield>(nullptr));
+			$$->back()->setLocation(makeSourceLoc(&@1));
+		}
+		| Async stat
+		{
+			$$ = $2;
+			for(auto& k : *$$)
+			{
+				auto function = dynamic_cast<AST::Function*>(k.get());
+				if(!function)
+					ast->error("only functions can be async", makeSourceLoc(&@1));
+				else
+					function->setAsync(true);
+			}
+		}
 		| Meta statlist End // '{' statlist '}'
 		{
 			$$ = new ExprList;
@@ -379,8 +595,68 @@ stat:
                 	$$->back()->setLocation(makeSourceLoc(&@1));
                 	delete $2;
 		}
+		| attributes stat
+		{
+			$$ = $2;
+			for(auto& k : *$$)
+			{
+				if(dynamic_cast<AST::ParallelFor*>(k.get()))
+				{
+					ast->error("attributes can not be applied to parallel loops", makeSourceLoc(&@1));
+					continue;
+				}
+
+				if(!dynamic_cast<AST::Function*>(k.get()) && !dynamic_cast<AST::While*>(k.get())
+					&& !dynamic_cast<AST::For*>(k.get()) && !dynamic_cast<AST::RangeFor*>(k.get()))
+				{
+					ast->error("attributes can only be applied to functions and loops", makeSourceLoc(&@1));
+					continue;
+				}
+
+				auto& attributes = k->getAttributes();
+				attributes.insert(attributes.end(), $1->begin(), $1->end());
+			}
+
+			delete $1;
+		}
 		;
 
+grainsize: { $$ = nullptr; }
+	| ',' exp { $$ = $2; }
+	;
+
+// Pairs of operator and variable name
+reductions: { $$ = new std::vector<std::string>; }
+	| Reduce reductionlist { $$ = $2; }
+	;
+
+reductionlist: reduceop Name { $$ = new std::vector<std::string>{*$1, *$2}; delete $1; delete $2; }
+	| reductionlist ',' reduceop Name { $$ = $1; $$->push_back(*$3); $$->push_back(*$4); delete $3; delete $4; }
+	;
+
+reduceop: '+' { $$ = new std::string("+"); }
+	| '*' { $$ = new std::string("*"); }
+	| Operator { $$ = $1; }
+	;
+
+// Comparisons can be defined for classes
+opname: Operator { $$ = $1; }
+	| EQ { $$ = new std::string("=="); }
+	| NEQ { $$ = new std::string("~="); }
+	;
+
+attributes: AttributeBegin attributelist ']' ']' { $$ = $2; }
+	;
+
+attributelist: attribute { $$ = new std::vector<std::string>; $$->push_back(*$1); delete $1; }
+	| attributelist ',' attribute { $$ = $1; $$->push_back(*$3); delete $3; }
+	;
+
+// Loop hints take a count like unroll(4)
+attribute: Name { $$ = $1; }
+	| Name '(' Integer ')' { $$ = $1; *$$ += "(" + std::to_string($3) + ")"; }
+	;
+
 elseif: Elseif exp Then block
 	{
 		AST::If* iffi;
@@ -399,7 +675,7 @@ elseif: Elseif exp Then block
 		for(auto& k : *$5)
 			iffi->getBody().push_back(k);
 		
-		static_cast<AST::If*>($$)->getElse().push_back(iffi);
+		lastElseif($$)->getElse().push_back(iffi);
 		iffi->setLocation(makeSourceLoc(&@1));
 		delete $5;
 	}
@@ -407,7 +683,8 @@ elseif: Elseif exp Then block
 	{
 		$$ = $1;
 		for(auto& k : *$3)
-			static_cast<AST::If*>($$)->getElse().push_back(k);
+			lastElseif($$)->getElse().push_back(k);
+		delete $3;
 	}
 	;
 
@@ -415,22 +692,33 @@ variabledef
 : Local varlist '=' explist
 {
 	$$ = new ExprList;
-		
-	// FIXME: Check sizes!
-	for(unsigned int i = 0; i < $2->size(); i++)
+
+	// Several results of one call are split up while generating code
+	if($2->size() != $4->size())
 	{
-		auto variable = std::dynamic_pointer_cast<AST::Variable>((*$2)[i]);
-		std::shared_ptr<AST::VariableDef> def = std::make_shared<AST::VariableDef>(variable->getName(), "", (*$4)[i]);
-		def->setLocation(makeSourceLoc(&@3));
-		
-		$$->push_back(def);
+		auto unpack = std::make_shared<AST::Unpack>(true);
+		unpack->getTargets() = std::move(*$2);
+		unpack->getValues() = std::move(*$4);
+		unpack->setLocation(makeSourceLoc(&@3));
+		$$->push_back(unpack);
+	}
+	else
+	{
+		for(unsigned int i = 0; i < $2->size(); i++)
+		{
+			auto variable = std::dynamic_pointer_cast<AST::Variable>((*$2)[i]);
+			std::shared_ptr<AST::VariableDef> def = std::make_shared<AST::VariableDef>(variable->getName(), "", (*$4)[i]);
+			def->setLocation(makeSourceLoc(&@3));
+
+			$$->push_back(def);
+		}
 	}
 		
 	delete $2;
 	delete $4;
 }
 	
-| Local varlist '=' explist ArrowRight pointermark Name
+| Local varlist '=' explist ArrowRight vartype
 {
 	$$ = new ExprList;
 		
@@ -438,7 +726,7 @@ variabledef
 	for(unsigned int i = 0; i < $2->size(); i++)
 	{
 		auto variable = std::dynamic_pointer_cast<AST::Variable>((*$2)[i]);
-		std::shared_ptr<AST::VariableDef> def = std::make_shared<AST::VariableDef>(variable->getName(), *$6 + *$7, (*$4)[i]);
+		std::shared_ptr<AST::VariableDef> def = std::make_shared<AST::VariableDef>(variable->getName(), *$6, (*$4)[i]);
 		def->setLocation(variable->getLocation());
 		
 		$$->push_back(def);
@@ -447,10 +735,9 @@ variabledef
 	delete $2;
 	delete $4;
 	delete $6;
-	delete $7;
 }
 	
-| Local varlist ArrowRight pointermark Name
+| Local varlist ArrowRight vartype
 {
 	$$ = new ExprList;
 		
@@ -458,7 +745,7 @@ variabledef
 	for(unsigned int i = 0; i < $2->size(); i++)
 	{
 		auto variable = std::dynamic_pointer_cast<AST::Variable>((*$2)[i]);
-		std::shared_ptr<AST::VariableDef> def = std::make_shared<AST::VariableDef>(variable->getName(), *$4 + *$5, nullptr);
+		std::shared_ptr<AST::VariableDef> def = std::make_shared<AST::VariableDef>(variable->getName(), *$4, nullptr);
 		def->setLocation(makeSourceLoc(&@1));
 		
 		$$->push_back(def);
@@ -466,10 +753,9 @@ variabledef
 		
 	delete $2;
 	delete $4;
-	delete $5;
 }
 
-| Extern Local varlist ArrowRight pointermark Name
+| Extern Local varlist ArrowRight vartype
 {
 	$$ = new ExprList;
 
@@ -477,7 +763,7 @@ variabledef
 	for(unsigned int i = 0; i < $3->size(); i++)
 	{
 		auto variable = std::dynamic_pointer_cast<AST::Variable>((*$3)[i]);
-		std::shared_ptr<AST::VariableDef> def = std::make_shared<AST::VariableDef>(variable->getName(), *$5 + *$6, nullptr);
+		std::shared_ptr<AST::VariableDef> def = std::make_shared<AST::VariableDef>(variable->getName(), *$5, nullptr);
 		def->setLocation(makeSourceLoc(&@1));
 		def->setExtern(true);
 
@@ -486,11 +772,29 @@ variabledef
 
 	delete $3;
 	delete $5;
-	delete $6;
 }
 
 // Arrays
-| Local varlist '=' explist ArrowRight pointermark Name '[' Integer ']'
+| Extern Local varlist ArrowRight vartype '[' Integer ']'
+{
+	$$ = new ExprList;
+
+	// FIXME: Check sizes!
+	for(unsigned int i = 0; i < $3->size(); i++)
+	{
+		auto variable = std::dynamic_pointer_cast<AST::Variable>((*$3)[i]);
+		std::shared_ptr<AST::VariableDef> def = std::make_shared<AST::VariableDef>(variable->getName(), *$5, nullptr, $7);
+		def->setLocation(makeSourceLoc(&@1));
+		def->setExtern(true);
+
+		$$->push_back(def);
+	}
+
+	delete $3;
+	delete $5;
+}
+
+| Local varlist '=' explist ArrowRight vartype '[' Integer ']'
 {
 	$$ = new ExprList;
 		
@@ -498,7 +802,7 @@ variabledef
 	for(unsigned int i = 0; i < $2->size(); i++)
 	{
 		auto variable = std::dynamic_pointer_cast<AST::Variable>((*$2)[i]);
-		std::shared_ptr<AST::VariableDef> def = std::make_shared<AST::VariableDef>(variable->getName(), *$6 + *$7, (*$4)[i], $9);
+		std::shared_ptr<AST::VariableDef> def = std::make_shared<AST::VariableDef>(variable->getName(), *$6, (*$4)[i], $8);
 		def->setLocation(makeSourceLoc(&@1));
 		
 		$$->push_back(def);
@@ -507,10 +811,9 @@ variabledef
 	delete $2;
 	delete $4;
 	delete $6;
-	delete $7;
 }
 	
-| Local varlist ArrowRight pointermark Name '[' Integer ']'
+| Local varlist ArrowRight vartype '[' Integer ']'
 {
 	$$ = new ExprList;
 		
@@ -518,7 +821,7 @@ variabledef
 	for(unsigned int i = 0; i < $2->size(); i++)
 	{
 		auto variable = std::dynamic_pointer_cast<AST::Variable>((*$2)[i]);
-		std::shared_ptr<AST::VariableDef> def = std::make_shared<AST::VariableDef>(variable->getName(), *$4 + *$5, nullptr, $7);
+		std::shared_ptr<AST::VariableDef> def = std::make_shared<AST::VariableDef>(variable->getName(), *$4, nullptr, $6);
 		def->setLocation(makeSourceLoc(&@1));
 		
 		$$->push_back(def);
@@ -526,7 +829,6 @@ variabledef
 		
 	delete $2;
 	delete $4;
-	delete $5;
 }
 ;
 
@@ -562,6 +864,24 @@ var: Name { $$ = new AST::Variable(*$1, nullptr); delete $1; $$->setLocation(mak
 	}
 	;
 		
+namelist: Name { $$ = new std::vector<std::string>; $$->push_back(*$1); delete $1; }
+	| namelist ',' Name { $$ = $1; $$->push_back(*$3); delete $3; }
+	;
+
+typename: Name { $$ = $1; }
+	| Name '<' typelist '>' { $$ = $1; *$$ += "<" + *$3 + ">"; delete $3; }
+	| '[' ']' pointermark typename { $$ = new std::string("[]" + *$3 + *$4); delete $3; delete $4; }
+	;
+
+// 'atomic' only qualifies variables and fields
+vartype: pointermark typename { $$ = $1; *$$ += *$2; delete $2; }
+	| Atomic pointermark typename { $$ = new std::string("atomic " + *$2 + *$3); delete $2; delete $3; }
+	;
+
+typelist: pointermark typename { $$ = $1; *$$ += *$2; delete $2; }
+	| typelist ',' pointermark typename { $$ = $1; *$$ += "," + *$3 + *$4; delete $3; delete $4; }
+	;
+
 pointermark: { $$ = new std::string(); } | pointermarklist { $$ = $1; }
 pointermarklist: '@' { $$ = new std::string("@"); }
 		| '@' pointermarklist { $$ = $2; *$$ += "@"; }
@@ -581,6 +901,7 @@ explist:	exp { $$ = new ExprList; $$->push_back(std::shared_ptr<AST::Expr>($1));
 exp:	'(' exp ')' { $$ = $2; }
 		| 		'@' exp { $$ = new AST::UnaryOp(std::shared_ptr<AST::Expr>($2), "@"); $$->setLocation(makeSourceLoc(&@1));}
 		| 		'$' exp { $$ = new AST::UnaryOp(std::shared_ptr<AST::Expr>($2), "$"); $$->setLocation(makeSourceLoc(&@1));}
+		| 		Await exp { $$ = new AST::Await(std::shared_ptr<AST::Expr>($2)); $$->setLocation(makeSourceLoc(&@1));}
 		| 		exp Operator exp { $$ = new AST::BinaryOp(std::shared_ptr<AST::Expr>($1), std::shared_ptr<AST::Expr>($3), *$2); $$->setLocation(makeSourceLoc(&@2)); }
 		| 		exp '+' exp { $$ = new AST::BinaryOp(std::shared_ptr<AST::Expr>($1), std::shared_ptr<AST::Expr>($3), "+"); $$->setLocation(makeSourceLoc(&@2)); }
 		| 		exp '-' exp { $$ = new AST::BinaryOp(std::shared_ptr<AST::Expr>($1), std::shared_ptr<AST::Expr>($3), "-"); $$->setLocation(makeSourceLoc(&@2)); }
@@ -600,9 +921,17 @@ exp:	'(' exp ')' { $$ = $2; }
 		| 		Char { $$ = new AST::Byte($1); $$->setLocation(makeSourceLoc(&@1)); }
 		| 		var { $$ = $1; $$->setLocation(makeSourceLoc(&@1)); }
 		| 		var '[' exp ']' { $$ = $1; static_cast<AST::Variable*>($1)->setIndex(std::shared_ptr<AST::Expr>($3)); $$->setLocation(makeSourceLoc(&@1)); }
+		| 		'{' explist '}'
+				{
+					auto array = new AST::ArrayLiteral;
+					array->getValues() = std::move(*$2);
+					$$ = array;
+					$$->setLocation(makeSourceLoc(&@1));
+					delete $2;
+				}
 		| 		LiteralString { auto str = new AST::String(*$1); str->unescape(); $$ = str; delete $1; $$->setLocation(makeSourceLoc(&@1)); }
 		
-		|		'<' pointermark Name '>' exp
+		|		'<' pointermark typename '>' exp
 				{
 					$$ = new AST::TypeCast(*$2 + *$3, std::shared_ptr<AST::Expr>($5));
 					$$->setLocation(makeSourceLoc(&@5));
@@ -674,45 +1003,52 @@ args:	'(' explist ')' { $$ = $2; }
 	| '(' ')' { $$ = new ExprList; }
 	;
 
-funcbody:	'(' parlist ')' ArrowRight pointermark Name block End 
+funcbody:	'(' parlist ')' ArrowRight resulttype block End 
 			{ 
 				$$ = new FunctionBody(); 
-				$$->Type = *$5 + *$6;
-				$$->Body = $7;
+				$$->Type = *$5;
+				$$->Body = $6;
 				$$->Args = $2;
 				
 				delete $5;
-				delete $6;
 			}
 			
-		| '(' parlist ',' ThreeDot ')' ArrowRight pointermark Name block End 
+		| '(' parlist ',' ThreeDot ')' ArrowRight resulttype block End 
 			{ 
 				$$ = new FunctionBody(); 
-				$$->Type = *$7 + *$8;
-				$$->Body = $9;
+				$$->Type = *$7;
+				$$->Body = $8;
 				$$->Args = $2;
 				$$->IsVariadic = true;
 				
 				delete $7;
-				delete $8;
 			}
 			
-		| '(' ThreeDot ')' ArrowRight pointermark Name block End 
+		| '(' ThreeDot ')' ArrowRight resulttype block End 
 			{ 
 				$$ = new FunctionBody(); 
-				$$->Type = *$5 + *$6;
-				$$->Body = $7;
+				$$->Type = *$5;
+				$$->Body = $6;
 				$$->Args = new ExprList;
 				$$->IsVariadic = true;
 				
-				delete $6;
 				delete $5;
 			}
 		;
 
+// Several result types are kept as "(int,bool)"
+// 'restrict' only qualifies parameters
+paramtype: pointermark typename { $$ = $1; *$$ += *$2; delete $2; }
+	| Restrict pointermark typename { $$ = new std::string("restrict " + *$2 + *$3); delete $2; delete $3; }
+	;
+
+resulttype: pointermark typename { $$ = $1; *$$ += *$2; delete $2; }
+	| pointermark typename ',' typelist { $$ = new std::string("(" + *$1 + *$2 + "," + *$4 + ")"); delete $1; delete $2; delete $4; }
+	;
+
 parlist: { $$ = new ExprList; }
-	| pointermark Name Name { $$ = new ExprList; $$->push_back(std::make_shared<AST::VariableDef>(*$3, *$1 + *$2, nullptr)); delete $1; delete $2; delete $3; }
-	| parlist ',' pointermark Name Name { $$ = $1; $$->push_back(std::make_shared<AST::VariableDef>(*$5, *$3 + *$4, nullptr)); delete $3; delete $4; delete $5; }
+	| paramtype Name { $$ = new ExprList; $$->push_back(std::make_shared<AST::VariableDef>(*$2, *$1, nullptr)); delete $1; delete $2; }
+	| parlist ',' paramtype Name { $$ = $1; $$->push_back(std::make_shared<AST::VariableDef>(*$4, *$3, nullptr)); delete $3; delete $4; }
 	;
 
 %%
@@ -720,11 +1056,15 @@ parlist: { $$ = new ExprList; }
 #define LEXER_IMPLEMENTED
 #include <iostream>
 static bool parserError = false;
+static bool interactive = false; // The REPL reports syntax errors and keeps going
+static bool quietErrors = false;
 
 extern int yylex_init(void**);
 extern int yylex_destroy(void*);
 extern void yyset_in(FILE*, void*);
 extern FILE* yyget_in(void*);
+extern struct yy_buffer_state* yy_scan_string(const char*, void*);
+extern void yy_delete_buffer(struct yy_buffer_state*, void*);
 
 int parse(const std::string& file, void* scanner, const AST::CompilationFlags& flags)
 {
@@ -791,41 +1131,64 @@ int parse(const std::string& file, void* scanner, const AST::CompilationFlags& f
 	SemanticChecker checker;
 	checker.check(*ast);
 
+	if(flags.run)
+	{
+		std::unique_ptr<llvm::Module> module = ast->generateLlvm(fname);
+		if(ast->getErrorCount() > 0)
+		{
+			std::cerr << "Encountered " << ast->getErrorCount() << " errors." << std::endl;
+			return EXIT_FAILURE;
+		}
+
+		std::vector<std::string> arguments = {file};
+		arguments.insert(arguments.end(), flags.runArguments.begin(), flags.runArguments.end());
+
+		Jit jit;
+		return jit.run(std::move(module), ast->takeContext(), ast->getRequiredModules(), arguments, ast->usesCoroutines());
+	}
+
 	ast->writeLlvm(flags.output + ".raw.ll");
 	ast->writeModule(flags.output + ".lmod");
 
-	system(("opt -S -O3 " + flags.output + ".raw.ll -o " + flags.output + ".ll ").c_str());
+	// LLVM only splits coroutines when asked to
+	std::string optFlags = (ast->usesCoroutines() ? "-enable-coroutines " : "");
+
+	// Loops whose requested vectorization failed get a warning from LLVM itself
+	system(("opt -S -O3 " + optFlags + flags.output + ".raw.ll -o " + flags.output + ".ll ").c_str());
 
 	if(!flags.isModule)
-		system(("clang -O3 -march=native -Wno-override-module " + ast->getRequiredLibraries() + " " + flags.output + ".ll -o " + flags.output).c_str());
+		system(("clang -O3 -march=" + ast->getTargetCpu() + " -pthread -Wno-override-module " + ast->getRequiredLibraries() + " " + flags.output + ".ll -o " + flags.output).c_str());
 	return 0;
 }
 
+static std::shared_ptr<AST::Module> includeFile(const std::string& file)
+{
+	FILE* fp = fopen(file.c_str(), "r");
+	if(!fp)
+		return nullptr;
+	
+	std::shared_ptr<AST::Module> oldAst = ast;
+	std::shared_ptr<AST::Module> newAst = std::make_shared<AST::Module>();
+	ast = newAst;
+	ast->setFlags(oldAst->getFlags());
+
+	void* scanner;
+	yylex_init(&scanner);
+	yyset_in(fp, scanner);
+	
+	int retval = yyparse(scanner);
+	yylex_destroy(scanner);
+	
+	ast = oldAst;
+	
+	fclose(fp);
+	return newAst;
+}
+
 int parse(FILE *fp, const AST::CompilationFlags& flags)
 {
 	ast->setFlags(flags);
-	ast->setIncludeCallback([] (const std::string& file) -> std::shared_ptr<AST::Module> {
-		FILE* fp = fopen(file.c_str(), "r");
-		if(!fp)
-			return nullptr;
-		
-		std::shared_ptr<AST::Module> oldAst = ast;
-		std::shared_ptr<AST::Module> newAst = std::make_shared<AST::Module>();
-		ast = newAst;
-		ast->setFlags(oldAst->getFlags());
-
-		void* scanner;
-		yylex_init(&scanner);
-		yyset_in(fp, scanner);
-		
-		int retval = yyparse(scanner);
-		yylex_destroy(scanner);
-		
-		ast = oldAst;
-		
-		fclose(fp);
-		return newAst;
-	});
+	ast->setIncludeCallback(includeFile);
 	
 	void* scanner;
 	yylex_init(&scanner);
@@ -837,11 +1200,149 @@ int parse(FILE *fp, const AST::CompilationFlags& flags)
 	return retval;
 }
 
+// Parses REPL input into ast, its statements are appended to the top level
+static bool parseString(const std::string& source, bool quiet)
+{
+	quietErrors = quiet;
+	parserError = false;
+
+	void* scanner;
+	yylex_init(&scanner);
+	auto* buffer = yy_scan_string(source.c_str(), scanner);
+	int retval = yyparse(scanner);
+	yy_delete_buffer(buffer, scanner);
+	yylex_destroy(scanner);
+
+	quietErrors = false;
+	return retval == 0 && !parserError;
+}
+
+// Counts blocks that are still waiting for their 'end', strings and comments are skipped
+static int openBlocks(const std::string& source)
+{
+	int open = 0;
+	std::string word, previous;
+	for(size_t i = 0; i <= source.size(); i++)
+	{
+		char c = (i < source.size() ? source[i] : ' ');
+		if(isalnum(c) || c == '_')
+		{
+			word += c;
+			continue;
+		}
+
+		if(!word.empty())
+		{
+			if(word == "do" || word == "if" || word == "operator" || word == "meta" || word == "repeat"
+				|| (word == "function" && previous != "extern"))
+				open++;
+			else if(word == "end" || word == "until")
+				open--;
+
+			previous = word;
+			word.clear();
+		}
+
+		if(c == '{')
+			open++;
+		else if(c == '}')
+			open--;
+		else if(c == '-' && i + 1 < source.size() && source[i + 1] == '-')
+			i = std::min(source.find('\n', i), source.size());
+		else if(c == '"' || c == '\'')
+		{
+			size_t end = i + 1;
+			while(end < source.size() && source[end] != c)
+				end += (source[end] == '\\' ? 2 : 1);
+			i = end;
+		}
+	}
+
+	return open;
+}
+
+// Compiles and runs one input after the other in the same JIT session. A lone
+// expression prints its value, definitions stay around for later inputs.
+int repl(const AST::CompilationFlags& flags)
+{
+	interactive = true;
+	ast->setFlags(flags);
+	ast->setSourceName("<repl>");
+	ast->setIncludeCallback(includeFile);
+
+	Jit jit;
+	if(!jit.start(ast->takeContext()))
+		return EXIT_FAILURE;
+
+	size_t libraries = 0;
+	unsigned int inputs = 0;
+	std::string source, line;
+	std::cout << "> " << std::flush;
+	while(std::getline(std::cin, line))
+	{
+		source += line + "\n";
+		if(openBlocks(source) > 0)
+		{
+			std::cout << "... " << std::flush;
+			continue;
+		}
+
+		auto& toplevel = ast->getTopLevel();
+		size_t first = toplevel.size();
+		bool parsed = parseString("return " + source, true) && toplevel.size() == first + 1
+			&& dynamic_cast<AST::Return*>(toplevel.back().get());
+
+		if(!parsed)
+		{
+			toplevel.resize(first);
+			parsed = parseString(source, false);
+		}
+
+		source.clear();
+		if(!parsed)
+		{
+			toplevel.resize(first);
+			std::cout << "> " << std::flush;
+			continue;
+		}
+
+		std::string entry;
+		std::unique_ptr<llvm::Module> module = ast->generateIncremental("input" + std::to_string(++inputs), entry);
+		if(module)
+		{
+			// Modules named by require are loaded by the input that requires them
+			bool loaded = true;
+			auto& required = ast->getRequiredModules();
+			for(; libraries < required.size(); libraries++)
+				loaded = jit.addLibrary(required[libraries]) && loaded;
+
+			if(jit.addModule(std::move(module), ast->usesCoroutines()) && loaded && !entry.empty())
+				if(auto run = reinterpret_cast<void (*)()>(jit.lookup(entry)))
+					run();
+		}
+
+		std::cout << "> " << std::flush;
+	}
+
+	std::cout << std::endl;
+
+	// The module refers to the context the JIT owns
+	ast = nullptr;
+	return 0;
+}
+
 void yyerror(YYLTYPE* locp, void*, char const* msg)
 {
 	//std::cout << "ERROR: " << locp->last_column << " STUFF " << msg << " at line " << yylineno << " ('" << yytext << "')" << std::endl;
-	ast->error(msg, makeSourceLoc(locp));
 	parserError = true;
+	if(interactive)
+	{
+		if(!quietErrors)
+			ast->error(msg, makeSourceLoc(locp));
+		return;
+	}
+
+	ast->error(msg, makeSourceLoc(locp));
 	std::exit(EXIT_FAILURE);
 }
 